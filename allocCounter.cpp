@@ -0,0 +1,115 @@
+#include "allocCounter.h"
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+	std::atomic< uint64_t > allocations(0);
+	thread_local uint64_t threadAllocations = 0;
+
+	void *allocate(size_t size) {
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		threadAllocations++;
+		return malloc(size ? size : 1);
+	}
+
+	std::atomic< uint64_t > matAllocations(0);
+	thread_local uint64_t threadMatAllocations = 0;
+
+	// counts new Mat buffers and leaves the work to the allocator it wraps, which
+	// also stays the one their release goes back to
+	class CountingMatAllocator : public cv::MatAllocator {
+	public:
+		explicit CountingMatAllocator(cv::MatAllocator *wrapped) : wrapped(wrapped) {}
+
+		cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, int flags,
+			cv::UMatUsageFlags usageFlags) const {
+			// a header over user data allocates nothing
+			if(!data) {
+				matAllocations.fetch_add(1, std::memory_order_relaxed);
+				threadMatAllocations++;
+			}
+			return wrapped->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		}
+
+		bool allocate(cv::UMatData *u, int accessFlags, cv::UMatUsageFlags usageFlags) const {
+			return wrapped->allocate(u, accessFlags, usageFlags);
+		}
+
+		void deallocate(cv::UMatData *u) const {
+			wrapped->deallocate(u);
+		}
+
+	private:
+		cv::MatAllocator *wrapped;
+	};
+}
+
+uint64_t allocationCount() {
+	return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t threadAllocationCount() {
+	return threadAllocations;
+}
+
+void countMatAllocations() {
+	// wraps the default found on the first call, later calls change nothing
+	static CountingMatAllocator counter(cv::Mat::getDefaultAllocator());
+	cv::Mat::setDefaultAllocator(&counter);
+}
+
+uint64_t matAllocationCount() {
+	return matAllocations.load(std::memory_order_relaxed);
+}
+
+uint64_t threadMatAllocationCount() {
+	return threadMatAllocations;
+}
+
+void *operator new(size_t size) {
+	void *p = allocate(size);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size) {
+	void *p = allocate(size);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return allocate(size);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+	free(p);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+
+// Heap allocations made through operator new, counted by replacing the global
+// operator new and delete. The replacement only reaches code linked into the
+// executable: OpenCV built as DLLs (the MSVC build) keeps its own operator new,
+// so allocations inside aruco are not counted there.
+uint64_t allocationCount();
+// allocations of the calling thread only
+uint64_t threadAllocationCount();
+
+// Mat buffers bypass operator new, they are counted by a cv::MatAllocator wrapped
+// around OpenCV's default one. That sees Mats created inside OpenCV as well;
+// counting starts once this was called.
+void countMatAllocations();
+uint64_t matAllocationCount();
+uint64_t threadMatAllocationCount();
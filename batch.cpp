@@ -0,0 +1,232 @@
+#include "batch.h"
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/videoio.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "frameRing.h"
+#include "pipeline.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	struct BatchFrame {
+		vector< vector< Point2f > > corners;
+		vector< int > ids;
+		// grey board region of the frame, as kept by CalibrationViews
+		Mat grey, charucoCorners, charucoIds;
+		Point offset;
+		Size imageSize;
+	};
+
+	// Takes the frames from the workers as they finish and hands them to the selector
+	// and the views in input order, so only the frames waiting for an earlier one are
+	// held. A worker more than window frames ahead of the oldest unfinished frame
+	// waits, the one holding that frame never does.
+	class InputOrder {
+	public:
+		InputOrder(KeyframeSelector *selector, CalibrationViews &views, int window)
+			: selector(selector), views(views), window(window), next(0), nFound(0) {}
+
+		// frame is null when the board was not found in it
+		void finish(int index, unique_ptr< BatchFrame > frame) {
+			unique_lock< mutex > lock(mtx);
+			advanced.wait(lock, [this, index] { return index < next + window; });
+			pending[index] = move(frame);
+			bool moved = false;
+			while(!pending.empty() && pending.begin()->first == next) {
+				unique_ptr< BatchFrame > f = move(pending.begin()->second);
+				pending.erase(pending.begin());
+				next++;
+				moved = true;
+				if(!f)
+					continue;
+				nFound++;
+				// selection depends on the views taken before
+				if(selector && !selector->consider(f->charucoCorners, f->charucoIds, f->imageSize))
+					continue;
+				views.add(f->corners, f->ids, f->charucoCorners, f->charucoIds, f->grey, f->offset, f->imageSize);
+			}
+			if(moved)
+				advanced.notify_all();
+		}
+
+		int found() const { return nFound; }
+
+	private:
+		KeyframeSelector *selector;
+		CalibrationViews &views;
+		int window, next, nFound;
+		map< int, unique_ptr< BatchFrame > > pending;
+		mutex mtx;
+		condition_variable advanced;
+	};
+
+	// fills the next frame and its input index, false once the input is exhausted; key is the
+	// frame's cache key when the source knows it without the pixels (the frame is then left
+	// empty if the cache has it), 0 otherwise
+	typedef function< bool(Mat &, int &, uint64_t &) > FrameSource;
+
+	// the frame's view, null when it has no charuco corners
+	unique_ptr< BatchFrame > detectFrame(FrameJob &job, uint64_t key, MarkerDetector &detector,
+		const Ptr< aruco::CharucoBoard > &charBoard, MarkerRefiner *refiner, bool crop, DetectionCache *cache,
+		DetectionCache::Entry &cached) {
+		unique_ptr< BatchFrame > frame;
+		if(cache) {
+			if(key == 0 && !job.image.empty())
+				key = hashImage(job.image);
+			if(key != 0 && cache->find(key, cached)) {
+				// cached views carry no image, calibration keeps their initial charuco corners
+				if(cached.charucoCorners.total() > 0) {
+					frame.reset(new BatchFrame);
+					frame->corners = cached.corners;
+					frame->ids = cached.ids;
+					frame->imageSize = cached.imageSize;
+					frame->charucoCorners = cached.charucoCorners;
+					frame->charucoIds = cached.charucoIds;
+					cached.charucoCorners.release();
+					cached.charucoIds.release();
+				}
+				return frame;
+			}
+		}
+		if(job.image.empty())
+			return frame;
+		{
+			ScopedTimer timer(Stats::DETECT);
+			detector.detect(job.image, job.corners, job.ids, job.rejected);
+		}
+		if(refiner)
+			refiner->refine(job.image, job.corners, job.ids, job.rejected);
+		job.charucoCorners.release();
+		job.charucoIds.release();
+		if(!job.ids.empty()) {
+			ScopedTimer timer(Stats::INTERPOLATE);
+			aruco::interpolateCornersCharuco(job.corners, job.ids, job.image, charBoard,
+				job.charucoCorners, job.charucoIds);
+		}
+		if(cache && key != 0)
+			cache->add(key, job.image.size(), job.corners, job.ids, job.charucoCorners, job.charucoIds);
+		if(job.charucoCorners.total() == 0)
+			return frame;
+
+		frame.reset(new BatchFrame);
+		frame->corners = job.corners;
+		frame->ids = job.ids;
+		// only the compact view outlives the frame, the charuco buffers go with it
+		compactView(job.corners, job.image, crop, frame->grey, frame->offset);
+		frame->imageSize = job.image.size();
+		frame->charucoCorners = job.charucoCorners;
+		frame->charucoIds = job.charucoIds;
+		job.charucoCorners.release();
+		job.charucoIds.release();
+		return frame;
+	}
+
+	void detectFrames(const FrameSource &next, MarkerDetector detector, const Ptr< aruco::CharucoBoard > &charBoard,
+		MarkerRefiner *refiner, bool crop, DetectionCache *cache, InputOrder &order) {
+		FrameJob job;
+		DetectionCache::Entry cached;
+		int index;
+		uint64_t key;
+		// every index is finished, with or without a board, or the frames after it would wait forever
+		while(next(job.image, index, key))
+			order.finish(index, detectFrame(job, key, detector, charBoard, refiner, crop, cache, cached));
+	}
+}
+
+bool collectBatchViews(const string &video, const string &imageDir, const MarkerDetector &detector,
+	const Ptr< aruco::CharucoBoard > &charBoard, bool refineStrategy, int threads, KeyframeSelector *selector,
+	DetectionCache *cache, CalibrationViews &views) {
+	int nThreads = threads > 0 ? threads : max((int)thread::hardware_concurrency(), 1);
+	int64 t0 = getTickCount();
+
+	vector< String > files;
+	VideoCapture cap;
+	unique_ptr< FrameRing > ring;
+	atomic< bool > reading(true);
+	thread reader;
+	FrameSource next;
+	atomic< int > nextFile(0);
+
+	if(!imageDir.empty()) {
+		glob(imageDir, files);
+		if(files.empty()) {
+			cerr << "No images found in " << imageDir << endl;
+			return false;
+		}
+		// workers decode their own images
+		next = [&files, &nextFile, cache](Mat &image, int &index, uint64_t &key) {
+			index = nextFile++;
+			if(index >= (int)files.size())
+				return false;
+			// a cached image is not even decoded
+			key = cache ? hashFile(files[index]) : 0;
+			if(key != 0 && cache->contains(key))
+				image.release();
+			else
+				image = imread(files[index]);
+			return true;
+		};
+	}
+	else {
+		if(!cap.open(video)) {
+			cerr << "Cannot open video " << video << endl;
+			return false;
+		}
+		// decoding is sequential, the ring blocks instead of dropping frames
+		Size frameSize((int)cap.get(CAP_PROP_FRAME_WIDTH), (int)cap.get(CAP_PROP_FRAME_HEIGHT));
+		ring.reset(new FrameRing(2 * nThreads, frameSize, CV_8UC3, false));
+		reader = thread(captureFrames, ref(cap), ref(*ring), cref(reading));
+		FrameRing &frames = *ring;
+		next = [&frames](Mat &image, int &index, uint64_t &key) {
+			key = 0;
+			return frames.pop(image, &index);
+		};
+	}
+
+	// a few frames per worker is enough slack for uneven detection times
+	InputOrder order(selector, views, 4 * nThreads);
+	MarkerRefiner refiner(charBoard.staticCast< aruco::Board >());
+	vector< thread > workers;
+	for(int i = 0; i < nThreads; i++)
+		workers.push_back(thread(detectFrames, cref(next), detector, cref(charBoard), refineStrategy ? &refiner : 0,
+			views.crop, cache, ref(order)));
+	for(int i = 0; i < nThreads; i++)
+		workers[i].join();
+	if(reader.joinable())
+		reader.join();
+
+	int nFrames = ring ? ring->pushed() : (int)files.size();
+	double seconds = (getTickCount() - t0) / getTickFrequency();
+	cout << "Batch: " << nFrames << " frames on " << nThreads << " threads in " << seconds << " s, board found in "
+		<< order.found() << ", " << views.size() << " selected for calibration" << endl;
+	refiner.report(cout);
+	if(cache)
+		cout << "Detection cache: " << cache->hits() << " frames reused, " << cache->added() << " added" << endl;
+	return true;
+}
+
+void collectCachedViews(DetectionCache &cache, KeyframeSelector *selector, CalibrationViews &views) {
+	DetectionCache::Entry entry;
+	int n = cache.size();
+	for(int i = 0; i < n; i++) {
+		cache.entry(i, entry);
+		if(entry.charucoCorners.total() == 0)
+			continue;
+		if(selector && !selector->consider(entry.charucoCorners, entry.charucoIds, entry.imageSize))
+			continue;
+		views.add(entry.corners, entry.ids, entry.charucoCorners, entry.charucoIds, Mat(), Point(), entry.imageSize);
+		// views keep the charuco Mats, the next entry needs its own
+		entry.charucoCorners.release();
+		entry.charucoIds.release();
+	}
+	cout << "Detection cache: " << views.size() << " of " << n << " cached frames selected for calibration" << endl;
+}
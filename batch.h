@@ -0,0 +1,22 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <string>
+#include "calibration.h"
+#include "detectionCache.h"
+#include "detector.h"
+#include "keyframe.h"
+
+// Runs detection and charuco interpolation over every frame of a video file or
+// image directory on a pool of workers, each with its own copy of detector and
+// its own scratch buffers. Frames where the board was found are passed in input
+// order through selector as soon as every earlier frame is done, or all kept when
+// selector is null, so memory follows the views kept rather than every board
+// frame; workers that run ahead by a few frames per thread wait. With a cache, frames
+// seen before (images by file contents, video frames by pixels) take their
+// detections from it and new ones are added.
+bool collectBatchViews(const std::string &video, const std::string &imageDir, const MarkerDetector &detector,
+	const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, bool refineStrategy, int threads,
+	KeyframeSelector *selector, DetectionCache *cache, CalibrationViews &views);
+
+// every cached frame with charuco corners, in the order they were cached, through selector
+void collectCachedViews(DetectionCache &cache, KeyframeSelector *selector, CalibrationViews &views);
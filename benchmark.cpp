@@ -0,0 +1,418 @@
+#include <opencv2/highgui.hpp>
+#include <opencv2/aruco/charuco.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <set>
+#include <cmath>
+#include "detector.h"
+#include "regression.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const char* about =
+		"Detection and interpolation benchmark over the bundled board images\n"
+		"  Every detector configuration runs on the bundled images and on synthetic\n"
+		"  warped, noisy and blurred renders of the same boards.\n"
+		"  With -rg it runs the calibration regression instead and exits with 1 when it fails.\n";
+	const char* keys =
+		"{p        | .     | Directory holding the bundled board images }"
+		"{n        | 20    | Synthetic views per board and distortion }"
+		"{r        | 3     | Timed repetitions per image }"
+		"{s        | 1     | Seed for the synthetic views }"
+		"{dp       |       | Extra detector parameters file to compare }"
+		"{o        |       | Write the results as JSON to this file }"
+		"{ocl      | true  | Repeat every configuration with OpenCL (UMat) preprocessing when a device exists }"
+		"{rg       | false | Calibration regression: calibrate from boards rendered through a known camera and check the result }"
+		"{rv       | 25    | Views per regression case }"
+		"{rd       | 60    | Regression budget for the detection p95 per view (ms) }"
+		"{rc       | 30    | Regression budget per calibration (s) }";
+
+	// the boards the bundled images were drawn from
+	struct BoardSpec {
+		const char *file;
+		int squaresX, squaresY, dictionary;
+	};
+	const BoardSpec specs[] = {
+		{ "board.png", 5, 7, 10 },
+		{ "charImg.png", 5, 7, 10 },
+		{ "charImg2.png", 5, 7, 10 },
+		{ "charImg7x7-14.png", 7, 7, 14 },
+		{ "charImg8x5-16.png", 5, 8, 16 },
+	};
+	const int specCount = sizeof(specs) / sizeof(specs[0]);
+
+	const Size frameSize(1280, 720);
+
+	// an image with the corners a correct detection has to find in it
+	struct Sample {
+		string set;
+		int board;
+		Mat image;
+		vector< Point2f > truth;
+		vector< int > truthIds;
+		int markers;
+	};
+
+	struct Config {
+		string name;
+		Ptr< aruco::DetectorParameters > params;
+		double downscale;
+		bool openCL;
+		// repetitions after the first run in steady state with the narrowed sweep
+		bool adaptiveWindow;
+		// identify against the board's ids only
+		bool boardIds;
+	};
+
+	struct Result {
+		string config, set;
+		int images;
+		double p50, p95, fps;
+		int markers, expectedMarkers;
+		int corners, expectedCorners;
+		double rms;
+		int falseIds;
+	};
+
+	void detectBoard(MarkerDetector &detector, const Ptr< aruco::CharucoBoard > &board, const Mat &image,
+		vector< vector< Point2f > > &corners, vector< int > &ids, Mat &charucoCorners, Mat &charucoIds) {
+		vector< vector< Point2f > > rejected;
+		detector.detect(image, corners, ids, rejected);
+		charucoCorners.release();
+		charucoIds.release();
+		if(ids.size() > 0)
+			aruco::interpolateCornersCharuco(corners, ids, image, board, charucoCorners, charucoIds);
+	}
+
+	bool inside(Point2f p, Size size, float margin) {
+		return p.x >= margin && p.y >= margin && p.x < size.width - margin && p.y < size.height - margin;
+	}
+
+	// reference corners from a default detection on an undistorted image
+	bool reference(const Ptr< aruco::CharucoBoard > &board, const Mat &image,
+		vector< Point2f > &truth, vector< int > &truthIds, vector< vector< Point2f > > &markerCorners) {
+		MarkerDetector detector(board->dictionary, aruco::DetectorParameters::create());
+		vector< int > ids;
+		Mat charucoCorners, charucoIds;
+		detectBoard(detector, board, image, markerCorners, ids, charucoCorners, charucoIds);
+		truth.clear();
+		truthIds.clear();
+		for(int i = 0; i < (int)charucoIds.total(); i++) {
+			truth.push_back(charucoCorners.at< Point2f >(i));
+			truthIds.push_back(charucoIds.at< int >(i));
+		}
+		return truth.size() == board->chessboardCorners.size();
+	}
+
+	Mat randomHomography(RNG &rng, Size source) {
+		vector< Point2f > src, dst;
+		src.push_back(Point2f(0, 0));
+		src.push_back(Point2f((float)source.width, 0));
+		src.push_back(Point2f((float)source.width, (float)source.height));
+		src.push_back(Point2f(0, (float)source.height));
+		float height = frameSize.height * rng.uniform(0.45f, 0.95f);
+		float scale = height / source.height;
+		float angle = rng.uniform(-30.f, 30.f) * (float)CV_PI / 180;
+		Point2f centre(frameSize.width * rng.uniform(0.35f, 0.65f), frameSize.height * rng.uniform(0.4f, 0.6f));
+		float c = cos(angle), s = sin(angle);
+		for(int i = 0; i < 4; i++) {
+			Point2f p = (src[i] - Point2f(source.width / 2.f, source.height / 2.f)) * scale;
+			Point2f jitter(rng.uniform(-0.08f, 0.08f) * height, rng.uniform(-0.08f, 0.08f) * height);
+			dst.push_back(centre + Point2f(c * p.x - s * p.y, s * p.x + c * p.y) + jitter);
+		}
+		return getPerspectiveTransform(src, dst);
+	}
+
+	// warps the board into a camera sized frame, the reference corners follow the homography
+	void addSynthetic(RNG &rng, int boardIndex, const Mat &render, const vector< Point2f > &truth,
+		const vector< int > &truthIds, const vector< vector< Point2f > > &markerCorners, int count,
+		vector< Sample > &samples) {
+		const char *sets[] = { "warp", "warp+noise", "warp+blur", "warp+noise+blur" };
+		for(int k = 0; k < count; k++) {
+			Mat H = randomHomography(rng, render.size());
+			Mat warped;
+			warpPerspective(render, warped, H, frameSize, INTER_LINEAR, BORDER_CONSTANT, Scalar::all(255));
+			vector< Point2f > mapped;
+			perspectiveTransform(truth, mapped, H);
+
+			Sample base;
+			base.board = boardIndex;
+			base.markers = 0;
+			for(size_t i = 0; i < mapped.size(); i++)
+				if(inside(mapped[i], frameSize, 5)) {
+					base.truth.push_back(mapped[i]);
+					base.truthIds.push_back(truthIds[i]);
+				}
+			for(size_t i = 0; i < markerCorners.size(); i++) {
+				vector< Point2f > m;
+				perspectiveTransform(markerCorners[i], m, H);
+				if(inside(m[0], frameSize, 1) && inside(m[1], frameSize, 1) && inside(m[2], frameSize, 1) &&
+					inside(m[3], frameSize, 1))
+					base.markers++;
+			}
+
+			for(int d = 0; d < 4; d++) {
+				Sample sample = base;
+				sample.set = sets[d];
+				Mat grey = warped.clone();
+				if(d == 1 || d == 3) {
+					Mat noise(grey.size(), CV_32F), value;
+					rng.fill(noise, RNG::NORMAL, 0, 6);
+					grey.convertTo(value, CV_32F);
+					value += noise;
+					value.convertTo(grey, CV_8U);
+				}
+				if(d == 2 || d == 3)
+					GaussianBlur(grey, grey, Size(0, 0), 1.5);
+				cvtColor(grey, sample.image, COLOR_GRAY2BGR);
+				samples.push_back(sample);
+			}
+		}
+	}
+
+	Result run(const Config &config, const string &setName, const vector< Sample > &samples,
+		const vector< Ptr< aruco::CharucoBoard > > &boards, int repeats) {
+		Result result;
+		result.config = config.name;
+		result.set = setName;
+		result.images = 0;
+		result.markers = result.expectedMarkers = 0;
+		result.corners = result.expectedCorners = 0;
+		result.falseIds = 0;
+		LatencyHistogram time;
+		double totalMs = 0, sqErr = 0;
+
+		for(size_t i = 0; i < samples.size(); i++) {
+			const Sample &sample = samples[i];
+			if(sample.set != setName)
+				continue;
+			const Ptr< aruco::CharucoBoard > &board = boards[sample.board];
+			// a fresh detector per image keeps tracking state out of the timings
+			MarkerDetector detector(board->dictionary, config.params);
+			detector.setDownscale(config.downscale);
+			detector.setOpenCL(config.openCL);
+			detector.setAdaptiveWindow(config.adaptiveWindow);
+			if(config.boardIds)
+				detector.setBoardIds(board->ids);
+			vector< vector< Point2f > > corners;
+			vector< int > ids;
+			Mat charucoCorners, charucoIds;
+			for(int r = 0; r < repeats; r++) {
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				detectBoard(detector, board, sample.image, corners, ids, charucoCorners, charucoIds);
+				chrono::duration< double, milli > ms = chrono::steady_clock::now() - start;
+				time.record(ms.count());
+				totalMs += ms.count();
+			}
+			result.images++;
+
+			set< int > boardIds(board->ids.begin(), board->ids.end()), found;
+			for(size_t m = 0; m < ids.size(); m++) {
+				if(boardIds.count(ids[m]))
+					found.insert(ids[m]);
+				else
+					result.falseIds++;
+			}
+			result.markers += min((int)found.size(), sample.markers);
+			result.expectedMarkers += sample.markers;
+
+			result.expectedCorners += (int)sample.truth.size();
+			for(int c = 0; c < (int)charucoIds.total(); c++) {
+				int id = charucoIds.at< int >(c);
+				for(size_t t = 0; t < sample.truthIds.size(); t++)
+					if(sample.truthIds[t] == id) {
+						Point2f d = charucoCorners.at< Point2f >(c) - sample.truth[t];
+						sqErr += d.dot(d);
+						result.corners++;
+						break;
+					}
+			}
+		}
+
+		result.p50 = time.percentile(0.5);
+		result.p95 = time.percentile(0.95);
+		result.fps = totalMs > 0 ? time.count() * 1000. / totalMs : 0;
+		result.rms = result.corners > 0 ? sqrt(sqErr / result.corners) : 0;
+		return result;
+	}
+
+	double fraction(int a, int b) {
+		return b > 0 ? (double)a / b : 0;
+	}
+
+	bool writeJson(const string &filename, const vector< Result > &results) {
+		ofstream out(filename.c_str());
+		if(!out)
+			return false;
+		out << "{\n  \"results\": [";
+		for(size_t i = 0; i < results.size(); i++) {
+			const Result &r = results[i];
+			out << (i ? ",\n" : "\n") << "    { \"config\": \"" << r.config << "\", \"set\": \"" << r.set
+				<< "\", \"images\": " << r.images << ", \"p50_ms\": " << r.p50 << ", \"p95_ms\": " << r.p95
+				<< ", \"fps\": " << r.fps << ", \"marker_rate\": " << fraction(r.markers, r.expectedMarkers)
+				<< ", \"corner_recall\": " << fraction(r.corners, r.expectedCorners)
+				<< ", \"rms_px\": " << r.rms << ", \"false_ids\": " << r.falseIds << " }";
+		}
+		out << "\n  ]\n}\n";
+		return (bool)out;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	CommandLineParser parser(argc, argv, keys);
+	parser.about(about);
+	string imageDir = parser.get<string>("p");
+	int synthetic = parser.get<int>("n");
+	int repeats = max(1, parser.get<int>("r"));
+	int seed = parser.get<int>("s");
+	string extraParams = parser.get<string>("dp");
+	string jsonFile = parser.get<string>("o");
+	bool compareOpenCL = parser.get<bool>("ocl");
+	if(!parser.check()) {
+		parser.printErrors();
+		return 0;
+	}
+	if(parser.get<bool>("rg")) {
+		RegressionLimits limits;
+		limits.detectMs = parser.get<double>("rd");
+		limits.calibrateSeconds = parser.get<double>("rc");
+		return runCalibrationRegression(parser.get<int>("rv"), (uint64_t)seed, limits, cout) ? 0 : 1;
+	}
+
+	vector< Config > configs;
+	Config config;
+	config.name = "default";
+	config.params = aruco::DetectorParameters::create();
+	config.downscale = 1;
+	config.openCL = false;
+	config.adaptiveWindow = false;
+	config.boardIds = false;
+	configs.push_back(config);
+
+	Ptr< aruco::DetectorParameters > tuned = aruco::DetectorParameters::create();
+	if(readDetectorParameters(imageDir + "/detectIn.yml", tuned)) {
+		config.name = "detectIn";
+		config.params = tuned;
+		configs.push_back(config);
+
+		config.name = "detectIn+subpix";
+		config.params = makePtr< aruco::DetectorParameters >(*tuned);
+		config.params->cornerRefinementMethod = aruco::CORNER_REFINE_SUBPIX;
+		configs.push_back(config);
+
+		config.name = "detectIn+ds2";
+		config.params = tuned;
+		config.downscale = 2;
+		configs.push_back(config);
+		config.downscale = 1;
+
+		config.name = "detectIn+aw";
+		config.adaptiveWindow = true;
+		configs.push_back(config);
+		config.adaptiveWindow = false;
+
+		config.name = "detectIn+bi";
+		config.boardIds = true;
+		configs.push_back(config);
+		config.boardIds = false;
+	}
+	else
+		cerr << "No detectIn.yml in " << imageDir << ", comparing the defaults only" << endl;
+	if(!extraParams.empty()) {
+		config.name = extraParams;
+		config.params = aruco::DetectorParameters::create();
+		if(!readDetectorParameters(extraParams, config.params)) {
+			cerr << "Invalid detector parameters file" << endl;
+			return 0;
+		}
+		configs.push_back(config);
+	}
+
+	if(compareOpenCL && ocl::haveOpenCL()) {
+		cout << "OpenCL device: " << ocl::Device::getDefault().name() << endl;
+		size_t cpuConfigs = configs.size();
+		for(size_t c = 0; c < cpuConfigs; c++) {
+			config = configs[c];
+			config.name += "+ocl";
+			config.openCL = true;
+			configs.push_back(config);
+		}
+	}
+	else if(compareOpenCL)
+		cout << "No OpenCL device, CPU configurations only" << endl;
+
+	// the bundled images and synthetic views of the same boards
+	vector< Ptr< aruco::CharucoBoard > > boards;
+	vector< Sample > samples;
+	RNG rng((uint64)seed);
+	for(int b = 0; b < specCount; b++) {
+		const BoardSpec &spec = specs[b];
+		boards.push_back(aruco::CharucoBoard::create(spec.squaresX, spec.squaresY, 0.04f, 0.02f,
+			aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(spec.dictionary))));
+		const Ptr< aruco::CharucoBoard > &board = boards.back();
+		vector< vector< Point2f > > markerCorners;
+
+		Sample sample;
+		sample.set = "bundled";
+		sample.board = b;
+		sample.image = imread(imageDir + "/" + spec.file);
+		if(sample.image.empty())
+			cerr << "Could not read " << spec.file << endl;
+		else {
+			if(!reference(board, sample.image, sample.truth, sample.truthIds, markerCorners))
+				cerr << spec.file << ": reference detection found " << sample.truth.size() << " of "
+					<< board->chessboardCorners.size() << " corners" << endl;
+			sample.markers = (int)markerCorners.size();
+			samples.push_back(sample);
+		}
+
+		// one clean render per distinct board is enough to warp from
+		if(b > 0 && specs[b - 1].squaresX == spec.squaresX && specs[b - 1].squaresY == spec.squaresY &&
+			specs[b - 1].dictionary == spec.dictionary)
+			continue;
+		Mat render;
+		board->draw(Size(spec.squaresX * 100 + 40, spec.squaresY * 100 + 40), render, 20, 1);
+		vector< Point2f > truth;
+		vector< int > truthIds;
+		if(!reference(board, render, truth, truthIds, markerCorners)) {
+			cerr << "Board " << spec.squaresX << "x" << spec.squaresY << " dictionary " << spec.dictionary
+				<< ": clean render is not fully detected, skipping its synthetic views" << endl;
+			continue;
+		}
+		addSynthetic(rng, b, render, truth, truthIds, markerCorners, synthetic, samples);
+	}
+	if(samples.empty()) {
+		cerr << "No images to benchmark" << endl;
+		return 0;
+	}
+
+	const char *sets[] = { "bundled", "warp", "warp+noise", "warp+blur", "warp+noise+blur" };
+	vector< Result > results;
+	cout << left << setw(22) << "config" << setw(17) << "set" << right << setw(7) << "images"
+		<< setw(9) << "p50 ms" << setw(9) << "p95 ms" << setw(8) << "fps" << setw(9) << "markers"
+		<< setw(9) << "corners" << setw(9) << "rms px" << setw(7) << "false" << endl;
+	cout << fixed;
+	for(size_t c = 0; c < configs.size(); c++)
+		for(int s = 0; s < 5; s++) {
+			Result r = run(configs[c], sets[s], samples, boards, repeats);
+			if(r.images == 0)
+				continue;
+			results.push_back(r);
+			cout << left << setw(22) << r.config << setw(17) << r.set << right << setw(7) << r.images
+				<< setprecision(2) << setw(9) << r.p50 << setw(9) << r.p95 << setprecision(1) << setw(8) << r.fps
+				<< setprecision(1) << setw(8) << 100 * fraction(r.markers, r.expectedMarkers) << "%"
+				<< setw(8) << 100 * fraction(r.corners, r.expectedCorners) << "%"
+				<< setprecision(3) << setw(9) << r.rms << setw(7) << r.falseIds << endl;
+		}
+
+	if(!jsonFile.empty() && !writeJson(jsonFile, results))
+		cerr << "Could not write " << jsonFile << endl;
+	return 0;
+}
@@ -0,0 +1,156 @@
+#include "boardImages.h"
+#include <opencv2/aruco/charuco.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include "detectionCache.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	struct Rendered {
+		string path;
+		uint64_t key, hash;
+		bool skipped, ok;
+	};
+
+	// manifest lines: filename, spec key and file hash, the hashes in hex
+	void readManifest(const string &filename, map< string, pair< uint64_t, uint64_t > > &manifest) {
+		ifstream in(filename.c_str());
+		string name;
+		unsigned long long key, hash;
+		string line;
+		while(getline(in, line)) {
+			istringstream fields(line);
+			if(fields >> name >> hex >> key >> hash)
+				manifest[name] = make_pair((uint64_t)key, (uint64_t)hash);
+		}
+	}
+
+	bool writeManifest(const string &filename, const map< string, pair< uint64_t, uint64_t > > &manifest) {
+		ofstream out(filename.c_str());
+		for(map< string, pair< uint64_t, uint64_t > >::const_iterator it = manifest.begin(); it != manifest.end(); ++it)
+			out << it->first << hex << " " << (unsigned long long)it->second.first << " "
+				<< (unsigned long long)it->second.second << dec << "\n";
+		return (bool)out;
+	}
+
+	int pixelsPerSquare(const BoardSpec &spec, double dpi) {
+		return (int)lround(spec.squareLength / 0.0254 * dpi);
+	}
+
+	uint64_t specKey(const BoardSpec &spec, double dpi, int compression) {
+		uint64_t h = hashBytes(0, 0);
+		h = hashBytes(&spec.squaresX, sizeof(spec.squaresX), h);
+		h = hashBytes(&spec.squaresY, sizeof(spec.squaresY), h);
+		h = hashBytes(&spec.dictionary, sizeof(spec.dictionary), h);
+		h = hashBytes(&spec.squareLength, sizeof(spec.squareLength), h);
+		h = hashBytes(&spec.markerLength, sizeof(spec.markerLength), h);
+		h = hashBytes(&dpi, sizeof(dpi), h);
+		return hashBytes(&compression, sizeof(compression), h);
+	}
+}
+
+string BoardSpec::filename() const {
+	ostringstream name;
+	name << "charImg" << squaresX << "x" << squaresY << "-" << dictionary << ".png";
+	return name.str();
+}
+
+bool parseBoardSpecs(const string &list, float squareLength, float markerLength, vector< BoardSpec > &specs) {
+	stringstream in(list);
+	string item;
+	while(getline(in, item, ',')) {
+		if(item.empty())
+			continue;
+		BoardSpec spec;
+		spec.squareLength = squareLength;
+		spec.markerLength = markerLength;
+		int n = sscanf(item.c_str(), "%dx%d-%d:%f:%f", &spec.squaresX, &spec.squaresY, &spec.dictionary,
+			&spec.squareLength, &spec.markerLength);
+		if(n != 3 && n != 5) {
+			cerr << "Board spec " << item << " is not WxH-D or WxH-D:square:marker" << endl;
+			return false;
+		}
+		if(spec.squaresX < 2 || spec.squaresY < 2 || spec.dictionary < 0 || spec.dictionary > 16 ||
+			spec.markerLength <= 0 || spec.markerLength >= spec.squareLength) {
+			cerr << "Board spec " << item << " is out of range" << endl;
+			return false;
+		}
+		specs.push_back(spec);
+	}
+	return !specs.empty();
+}
+
+bool generateBoards(const vector< BoardSpec > &specs, const string &outputDir, double dpi, int compression) {
+	string dir = outputDir.empty() ? string(".") : outputDir;
+	string manifestFile = dir + "/board.cache";
+	map< string, pair< uint64_t, uint64_t > > manifest;
+	readManifest(manifestFile, manifest);
+
+	vector< Rendered > rendered(specs.size());
+	for(size_t i = 0; i < specs.size(); i++) {
+		Rendered &r = rendered[i];
+		r.path = dir + "/" + specs[i].filename();
+		r.key = specKey(specs[i], dpi, compression);
+		map< string, pair< uint64_t, uint64_t > >::const_iterator it = manifest.find(specs[i].filename());
+		r.skipped = it != manifest.end() && it->second.first == r.key && it->second.second == hashFile(r.path);
+		r.ok = r.skipped;
+	}
+
+	vector< int > params;
+	params.push_back(IMWRITE_PNG_COMPRESSION);
+	params.push_back(compression);
+	// each board is drawn and encoded on its own, large print boards keep every core busy
+	parallel_for_(Range(0, (int)specs.size()), [&](const Range &range) {
+		for(int i = range.start; i < range.end; i++) {
+			Rendered &r = rendered[i];
+			if(r.skipped)
+				continue;
+			const BoardSpec &spec = specs[i];
+			Ptr< aruco::Dictionary > dictionary = aruco::getPredefinedDictionary(spec.dictionary);
+			if(dictionary->bytesList.rows < spec.squaresX * spec.squaresY / 2) {
+				cerr << spec.filename() << ": dictionary " << spec.dictionary << " has only "
+					<< dictionary->bytesList.rows << " markers" << endl;
+				continue;
+			}
+			Ptr< aruco::CharucoBoard > board = aruco::CharucoBoard::create(spec.squaresX, spec.squaresY,
+				spec.squareLength, spec.markerLength, dictionary);
+			int square = pixelsPerSquare(spec, dpi);
+			int margin = square / 2;
+			Mat image;
+			board->draw(Size(spec.squaresX * square + 2 * margin, spec.squaresY * square + 2 * margin), image, margin, 1);
+			r.ok = imwrite(r.path, image, params);
+			if(!r.ok)
+				cerr << "Cannot write " << r.path << endl;
+			else
+				r.hash = hashFile(r.path);
+		}
+	});
+
+	bool ok = true;
+	int written = 0, unchanged = 0;
+	for(size_t i = 0; i < specs.size(); i++) {
+		const Rendered &r = rendered[i];
+		ok = ok && r.ok;
+		unchanged += r.skipped;
+		if(!r.ok || r.skipped)
+			continue;
+		manifest[specs[i].filename()] = make_pair(r.key, r.hash);
+		written++;
+		double width = specs[i].squaresX * specs[i].squareLength + specs[i].squareLength;
+		double height = specs[i].squaresY * specs[i].squareLength + specs[i].squareLength;
+		cout << r.path << ": " << width * 1000 << " x " << height * 1000 << " mm at " << dpi << " dpi" << endl;
+	}
+	cout << "Boards written: " << written << ", unchanged: " << unchanged << endl;
+	if(written > 0 && !writeManifest(manifestFile, manifest)) {
+		cerr << "Cannot write " << manifestFile << endl;
+		return false;
+	}
+	return ok;
+}
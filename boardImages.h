@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// A charuco board to print: squares, predefined dictionary and side lengths in meters.
+struct BoardSpec {
+	int squaresX, squaresY, dictionary;
+	float squareLength, markerLength;
+
+	// charImg<W>x<H>-<D>.png, the naming of the bundled boards
+	std::string filename() const;
+};
+
+// comma separated specs "WxH-D" or "WxH-D:square:marker", lengths in meters default to the given ones
+bool parseBoardSpecs(const std::string &list, float squareLength, float markerLength,
+	std::vector< BoardSpec > &specs);
+
+// Renders every spec in parallel at dpi, with a margin of half a square, and writes
+// it to outputDir with the given PNG compression level (0-9). A board.cache
+// manifest in outputDir records what produced each file and its hash, so boards
+// whose file is still the one written for the same spec, resolution and
+// compression are skipped.
+bool generateBoards(const std::vector< BoardSpec > &specs, const std::string &outputDir, double dpi,
+	int compression);
@@ -0,0 +1,68 @@
+#include "boardProfile.h"
+#include <opencv2/aruco.hpp>
+#include <opencv2/calib3d.hpp>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	template< typename T > void readField(const FileStorage &fs, const char *name, T &value) {
+		FileNode node = fs[name];
+		if(!node.empty())
+			node >> value;
+	}
+
+	void readFlag(const FileStorage &fs, const char *name, bool &value) {
+		FileNode node = fs[name];
+		if(!node.empty())
+			value = (int)node != 0;
+	}
+}
+
+int BoardProfile::calibrationFlags() const {
+	int flags = 0;
+	if(fixAspectRatio)
+		flags |= CALIB_FIX_ASPECT_RATIO;
+	if(zeroTangentDist)
+		flags |= CALIB_ZERO_TANGENT_DIST;
+	if(fixPrincipalPoint)
+		flags |= CALIB_FIX_PRINCIPAL_POINT;
+	return flags;
+}
+
+bool BoardProfile::valid() const {
+	// NaN lengths fail every comparison, so they are rejected too
+	if(!(squaresX >= 2 && squaresY >= 2 && markerLength > 0 && markerLength < squareLength &&
+		dictionary >= 0 && dictionary <= aruco::DICT_ARUCO_ORIGINAL && aspectRatio > 0))
+		return false;
+	// the board takes a marker for every other square, the same check as boardImages
+	Ptr< aruco::Dictionary > dict = aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(dictionary));
+	return dict->bytesList.rows >= (int64_t)squaresX * squaresY / 2;
+}
+
+bool readBoardProfile(const string &filename, BoardProfile &profile) {
+	FileStorage fs(filename, FileStorage::READ);
+	if(!fs.isOpened()) {
+		cerr << "Cannot open board profile " << filename << endl;
+		return false;
+	}
+	readField(fs, "squaresX", profile.squaresX);
+	readField(fs, "squaresY", profile.squaresY);
+	readField(fs, "squareLength", profile.squareLength);
+	readField(fs, "markerLength", profile.markerLength);
+	readField(fs, "dictionary", profile.dictionary);
+	readField(fs, "detectorParams", profile.detectorParams);
+	readFlag(fs, "refineStrategy", profile.refineStrategy);
+	readField(fs, "aspectRatio", profile.aspectRatio);
+	readFlag(fs, "fixAspectRatio", profile.fixAspectRatio);
+	readFlag(fs, "zeroTangentDist", profile.zeroTangentDist);
+	readFlag(fs, "fixPrincipalPoint", profile.fixPrincipalPoint);
+	if(!profile.valid()) {
+		cerr << "Board profile " << filename << " is out of range or needs more markers than its dictionary holds"
+			<< endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+
+// Everything about the board and the solve that used to be compiled in, so a
+// board can be switched without a rebuild. Command line keys override it.
+struct BoardProfile {
+	BoardProfile()
+		: squaresX(5), squaresY(7), squareLength(0.04f), markerLength(0.02f), dictionary(10),
+		detectorParams("detectIn.yml"), refineStrategy(false), aspectRatio(1), fixAspectRatio(true),
+		zeroTangentDist(false), fixPrincipalPoint(false) {}
+
+	int squaresX, squaresY;
+	float squareLength, markerLength;
+	int dictionary;
+	std::string detectorParams;
+	bool refineStrategy;
+	double aspectRatio;
+	bool fixAspectRatio, zeroTangentDist, fixPrincipalPoint;
+
+	// calibrateCamera flags of the profile
+	int calibrationFlags() const;
+	// a board CharucoBoard::create and getPredefinedDictionary accept, with a
+	// dictionary that holds a marker for every other square
+	bool valid() const;
+};
+
+// FileStorage YAML/XML with any of the fields above under the same names; missing
+// fields keep their current value
+bool readBoardProfile(const std::string &filename, BoardProfile &profile);
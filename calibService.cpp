@@ -0,0 +1,379 @@
+#include "calibService.h"
+#include <opencv2/calib3d.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "cameraParams.h"
+#include "network.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const char jobMagic[8] = { 'C', 'H', 'A', 'R', 'J', 'O', 'B', 'S' };
+	const char replyMagic[8] = { 'C', 'H', 'A', 'R', 'C', 'A', 'L', 'R' };
+	const uint32_t version = 1;
+	// a station that stalls this long in the middle of a job is dropped
+	const int receiveTimeoutMs = 30000;
+	const int maxViews = 100000, maxMarkers = 4096, maxCorners = 16384, maxSquares = 100;
+	const uint32_t maxReplyBytes = 1 << 20;
+	// stations sending at the same time, further connections are refused
+	const int maxReaders = 64;
+	// views the store is sized for up front, the header's count is only a claim
+	const int reservedViews = 64;
+
+	// fields at fixed offsets, every member naturally aligned
+	struct JobHeader {
+		char magic[8];
+		uint32_t version;
+		int32_t squaresX, squaresY, dictionary;
+		float squareLength, markerLength;
+		int32_t flags, robust;
+		double aspectRatio;
+		int32_t width, height;
+		int32_t views;
+		char station[64];
+	};
+	static_assert(sizeof(JobHeader) == 128, "calibration jobs have a fixed layout");
+
+	// followed by the same payload as a detection cache record: markers * 4
+	// corners, markers ids, charucoCount corners and ids, padded to 8 bytes
+	struct ViewHeader {
+		int32_t markers, charucoCount;
+	};
+
+	// followed by textBytes of the calibration YAML, or of the error when ok is 0
+	struct ReplyHeader {
+		char magic[8];
+		int32_t ok, views;
+		double repError;
+		uint32_t textBytes, reserved;
+	};
+
+	size_t payloadSize(const ViewHeader &h) {
+		size_t bytes = (size_t)h.markers * (4 * sizeof(Point2f) + sizeof(int32_t)) +
+			(size_t)h.charucoCount * (sizeof(Point2f) + sizeof(int32_t));
+		return (bytes + 7) & ~(size_t)7;
+	}
+
+	struct Job {
+		Socket client;
+		CalibrationRequest request;
+		CalibrationViews views;
+	};
+
+	// jobs accepted but not yet picked up by a worker
+	class JobQueue {
+	public:
+		void push(unique_ptr< Job > job) {
+			lock_guard< mutex > lock(mtx);
+			jobs.push_back(move(job));
+			ready.notify_one();
+		}
+
+		unique_ptr< Job > pop() {
+			unique_lock< mutex > lock(mtx);
+			ready.wait(lock, [this] { return !jobs.empty(); });
+			unique_ptr< Job > job = move(jobs.front());
+			jobs.pop_front();
+			return job;
+		}
+
+		size_t size() {
+			lock_guard< mutex > lock(mtx);
+			return jobs.size();
+		}
+
+	private:
+		mutex mtx;
+		condition_variable ready;
+		deque< unique_ptr< Job > > jobs;
+	};
+
+	bool sendJob(Socket s, const CalibrationRequest &request, const CalibrationViews &views) {
+		const BoardProfile &profile = request.profile;
+		JobHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, jobMagic, sizeof(jobMagic));
+		h.version = version;
+		h.squaresX = profile.squaresX;
+		h.squaresY = profile.squaresY;
+		h.dictionary = profile.dictionary;
+		h.squareLength = profile.squareLength;
+		h.markerLength = profile.markerLength;
+		h.flags = profile.calibrationFlags();
+		h.robust = request.robust;
+		h.aspectRatio = profile.aspectRatio;
+		h.width = views.imgSize.width;
+		h.height = views.imgSize.height;
+		h.views = views.size();
+		strncpy(h.station, request.station.c_str(), sizeof(h.station) - 1);
+		if(!sendAll(s, &h, sizeof(h)))
+			return false;
+
+		// one buffer reused for every view, each goes out in a single send
+		vector< char > record;
+		for(int v = 0; v < views.size(); v++) {
+			ViewHeader vh;
+			vh.markers = views.markers.markers(v);
+			vh.charucoCount = (int32_t)views.initialCharucoIds[v].total();
+			record.assign(sizeof(vh) + payloadSize(vh), 0);
+			memcpy(record.data(), &vh, sizeof(vh));
+			Point2f *outCorners = (Point2f *)&record[sizeof(vh)];
+			memcpy(outCorners, views.markers.viewCorners(v), 4 * vh.markers * sizeof(Point2f));
+			int *outIds = (int *)(outCorners + 4 * vh.markers);
+			memcpy(outIds, views.markers.viewIds(v), vh.markers * sizeof(int));
+			Point2f *outCharuco = (Point2f *)(outIds + vh.markers);
+			int *outCharucoIds = (int *)(outCharuco + vh.charucoCount);
+			for(int c = 0; c < vh.charucoCount; c++) {
+				outCharuco[c] = views.initialCharucoCorners[v].at< Point2f >(c);
+				outCharucoIds[c] = views.initialCharucoIds[v].at< int >(c);
+			}
+			if(!sendAll(s, record.data(), record.size()))
+				return false;
+		}
+		return true;
+	}
+
+	bool receiveJob(Socket s, Job &job) {
+		JobHeader h;
+		if(!receiveAll(s, &h, sizeof(h)))
+			return false;
+		if(memcmp(h.magic, jobMagic, sizeof(jobMagic)) != 0 || h.version != version) {
+			cerr << "Not a calibration job (or of another version)" << endl;
+			return false;
+		}
+		// negated so that NaN lengths fail too
+		if(h.views < 0 || h.views > maxViews || h.width <= 0 || h.height <= 0 || h.squaresX < 2 || h.squaresY < 2 ||
+			h.squaresX > maxSquares || h.squaresY > maxSquares || h.dictionary < 0 ||
+			h.dictionary > aruco::DICT_ARUCO_ORIGINAL || !(h.markerLength > 0) ||
+			!(h.markerLength < h.squareLength) || !(h.aspectRatio > 0)) {
+			cerr << "Invalid calibration job header" << endl;
+			return false;
+		}
+		h.station[sizeof(h.station) - 1] = 0;
+
+		BoardProfile &profile = job.request.profile;
+		profile.squaresX = h.squaresX;
+		profile.squaresY = h.squaresY;
+		profile.dictionary = h.dictionary;
+		profile.squareLength = h.squareLength;
+		profile.markerLength = h.markerLength;
+		profile.aspectRatio = h.aspectRatio;
+		profile.fixAspectRatio = (h.flags & CALIB_FIX_ASPECT_RATIO) != 0;
+		profile.zeroTangentDist = (h.flags & CALIB_ZERO_TANGENT_DIST) != 0;
+		profile.fixPrincipalPoint = (h.flags & CALIB_FIX_PRINCIPAL_POINT) != 0;
+		job.request.robust = h.robust != 0;
+		job.request.station = h.station;
+
+		Size imageSize(h.width, h.height);
+		int boardCorners = (h.squaresX - 1) * (h.squaresY - 1);
+		// grows as the views actually arrive
+		job.views.reserve(min(h.views, reservedViews), (h.squaresX * h.squaresY) / 2);
+		vector< char > record;
+		vector< vector< Point2f > > corners;
+		vector< int > ids;
+		int skipped = 0;
+		for(int v = 0; v < h.views; v++) {
+			ViewHeader vh;
+			if(!receiveAll(s, &vh, sizeof(vh)))
+				return false;
+			if(vh.markers < 0 || vh.markers > maxMarkers || vh.charucoCount < 0 || vh.charucoCount > maxCorners) {
+				cerr << "Invalid view " << v << " in the calibration job from " << job.request.station << endl;
+				return false;
+			}
+			record.resize(payloadSize(vh));
+			if(!record.empty() && !receiveAll(s, record.data(), record.size()))
+				return false;
+			const Point2f *inCorners = (const Point2f *)record.data();
+			const int *inIds = (const int *)(inCorners + 4 * vh.markers);
+			const Point2f *inCharuco = (const Point2f *)(inIds + vh.markers);
+			const int *inCharucoIds = (const int *)(inCharuco + vh.charucoCount);
+			for(int c = 0; c < vh.charucoCount; c++)
+				if(inCharucoIds[c] < 0 || inCharucoIds[c] >= boardCorners) {
+					cerr << "Corner id " << inCharucoIds[c] << " of view " << v << " from " << job.request.station
+						<< " is not on the board" << endl;
+					return false;
+				}
+			// a 'c' capture can hold too few corners for a pose, the local solve cannot use it either
+			if(vh.charucoCount < 4) {
+				skipped++;
+				continue;
+			}
+			corners.resize(vh.markers);
+			for(int m = 0; m < vh.markers; m++)
+				corners[m].assign(inCorners + 4 * m, inCorners + 4 * m + 4);
+			ids.assign(inIds, inIds + vh.markers);
+			// the record buffer is reused, the views get their own copy
+			Mat charucoCorners = Mat(vh.charucoCount, 1, CV_32FC2, (void *)inCharuco).clone();
+			Mat charucoIds = Mat(vh.charucoCount, 1, CV_32SC1, (void *)inCharucoIds).clone();
+			job.views.add(corners, ids, charucoCorners, charucoIds, Mat(), Point(), imageSize);
+		}
+		if(skipped > 0)
+			cout << "Skipped " << skipped << " views with fewer than 4 corners from " << job.request.station << endl;
+		return true;
+	}
+
+	bool sendReply(Socket s, bool ok, int views, double repError, const string &text) {
+		ReplyHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, replyMagic, sizeof(replyMagic));
+		h.ok = ok;
+		h.views = views;
+		h.repError = repError;
+		h.textBytes = (uint32_t)text.size();
+		return sendAll(s, &h, sizeof(h)) && sendAll(s, text.data(), text.size());
+	}
+
+	// shared by the acceptor, the workers and the detached connection readers, so it
+	// lives as long as the last of them
+	struct ServerState {
+		ServerState() : readers(0) {}
+
+		JobQueue queue;
+		atomic< int > readers;
+	};
+
+	// each connection is read on its own thread, a station that stalls only holds up itself
+	void readJob(shared_ptr< ServerState > state, Socket client) {
+		// an uncaught exception on a detached thread would end the whole server
+		try {
+			unique_ptr< Job > job(new Job);
+			job->client = client;
+			if(receiveJob(client, *job)) {
+				cout << "Queued " << job->views.size() << " views from " << job->request.station << " ("
+					<< state->queue.size() + 1 << " waiting)" << endl;
+				state->queue.push(move(job));
+				client = invalidSocket;
+			}
+		}
+		catch(const exception &e) {
+			cerr << "Dropping a calibration job: " << e.what() << endl;
+		}
+		if(client != invalidSocket)
+			closeSocket(client);
+		state->readers--;
+	}
+
+	void solveJob(Job &job) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		const BoardProfile &profile = job.request.profile;
+		int flags = profile.calibrationFlags();
+		CalibrationResult calib;
+		string text, error = "calibration failed";
+		bool ok = false;
+		// an OpenCV assertion or a failed allocation on one station's data must not take the other jobs down with the worker
+		try {
+			Ptr< aruco::Dictionary > dictionary =
+				aruco::getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(profile.dictionary));
+			Ptr< aruco::CharucoBoard > charBoard = aruco::CharucoBoard::create(profile.squaresX, profile.squaresY,
+				profile.squareLength, profile.markerLength, dictionary);
+			ok = job.views.size() > 0 && calibrateCharuco(job.views, charBoard, flags, profile.aspectRatio, calib);
+			if(ok && job.request.robust)
+				rejectOutlierViews(charBoard, job.views.imgSize, flags, calib);
+			if(ok)
+				text = cameraParamsText(job.views.imgSize, (float)profile.aspectRatio, flags, calib.cameraMatrix,
+					calib.distCoeffs, calib.repError);
+		}
+		catch(const exception &e) {
+			ok = false;
+			error = string("calibration failed: ") + e.what();
+		}
+		bool sent = ok ? sendReply(job.client, true, (int)calib.keptViews.size(), calib.repError, text) :
+			sendReply(job.client, false, 0, 0, error);
+		closeSocket(job.client);
+
+		chrono::duration< double > taken = chrono::steady_clock::now() - start;
+		cout << "Job from " << job.request.station << ": " << job.views.size() << " views, ";
+		if(ok)
+			cout << "rep error " << calib.repError;
+		else
+			cout << "failed";
+		cout << ", " << taken.count() << " s" << (sent ? "" : ", reply lost") << endl;
+	}
+}
+
+bool submitCalibration(const string &server, const CalibrationRequest &request, const CalibrationViews &views,
+	string &yaml, double &repError) {
+	Socket s = connectSocket(server, false);
+	if(s == invalidSocket)
+		return false;
+	cout << "Sending " << views.size() << " views to " << server << endl;
+	if(!sendJob(s, request, views)) {
+		cerr << "Cannot send the calibration job to " << server << endl;
+		closeSocket(s);
+		return false;
+	}
+
+	// the solve may take a while, only the reply itself has to arrive in time
+	ReplyHeader h;
+	bool ok = receiveAll(s, &h, sizeof(h)) && memcmp(h.magic, replyMagic, sizeof(replyMagic)) == 0 &&
+		h.textBytes <= maxReplyBytes;
+	string text;
+	if(ok) {
+		setReceiveTimeout(s, receiveTimeoutMs);
+		text.resize(h.textBytes);
+		ok = text.empty() || receiveAll(s, &text[0], text.size());
+	}
+	closeSocket(s);
+	if(!ok) {
+		cerr << "No valid reply from the calibration server " << server << endl;
+		return false;
+	}
+	if(!h.ok) {
+		cerr << "The calibration server " << server << " reported: " << text << endl;
+		return false;
+	}
+	yaml.swap(text);
+	repError = h.repError;
+	cout << "Calibrated remotely from " << h.views << " views" << endl;
+	return true;
+}
+
+void runCalibrationServer(const string &port, int workers) {
+	Socket listener = listenSocket(port);
+	if(listener == invalidSocket)
+		return;
+	if(workers <= 0)
+		workers = max((int)thread::hardware_concurrency(), 1);
+	cout << "Serving calibration jobs on port " << port << " with " << workers << " workers" << endl;
+
+	shared_ptr< ServerState > state = make_shared< ServerState >();
+	vector< thread > pool;
+	for(int i = 0; i < workers; i++)
+		pool.push_back(thread([state] {
+			// a job without a client ends the worker
+			for(unique_ptr< Job > job = state->queue.pop(); job->client != invalidSocket; job = state->queue.pop())
+				solveJob(*job);
+		}));
+
+	Socket client;
+	while((client = acceptSocket(listener)) != invalidSocket) {
+		if(state->readers >= maxReaders) {
+			cerr << "Too many stations sending at once, refusing a connection" << endl;
+			closeSocket(client);
+			continue;
+		}
+		setReceiveTimeout(client, receiveTimeoutMs);
+		state->readers++;
+		thread(readJob, state, client).detach();
+	}
+	cerr << "The calibration listener failed" << endl;
+	closeSocket(listener);
+
+	for(int i = 0; i < workers; i++) {
+		unique_ptr< Job > stop(new Job);
+		stop->client = invalidSocket;
+		state->queue.push(move(stop));
+	}
+	for(size_t i = 0; i < pool.size(); i++)
+		pool[i].join();
+}
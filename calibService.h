@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include "boardProfile.h"
+#include "calibration.h"
+
+// What a capture station sends along with its views: the board, how to solve
+// and a name for the server's log.
+struct CalibrationRequest {
+	BoardProfile profile;
+	bool robust;
+	std::string station;
+};
+
+// Sends the detections of views (markers and initial charuco corners, in the
+// detection cache's flat record layout, no images) to the server at host:port and
+// waits for the solve; yaml receives what saveCameraParams would have written.
+bool submitCalibration(const std::string &server, const CalibrationRequest &request,
+	const CalibrationViews &views, std::string &yaml, double &repError);
+
+// Calibration service: accepts jobs from stations on port, reads each on its own
+// thread, queues them and solves them on a pool of workers (0 uses all cores),
+// answering each on its own connection. Without images the server keeps each
+// view's initial charuco corners. Runs until the listener fails.
+void runCalibrationServer(const std::string &port, int workers);
@@ -0,0 +1,403 @@
+#include "calibration.h"
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+void compactView(const vector< vector< Point2f > > &corners, const Mat &image, bool crop, Mat &grey, Point &offset) {
+	Rect area(0, 0, image.cols, image.rows);
+	if(crop && !corners.empty()) {
+		// markers padded by about one marker side still hold every corner next to them
+		vector< Point2f > pts;
+		double side = 0;
+		for(size_t i = 0; i < corners.size(); i++) {
+			pts.insert(pts.end(), corners[i].begin(), corners[i].end());
+			side += arcLength(corners[i], true) / 4;
+		}
+		int pad = cvCeil(side / corners.size()) + 10;
+		Rect box = boundingRect(pts);
+		box = Rect(box.x - pad, box.y - pad, box.width + 2 * pad, box.height + 2 * pad);
+		area &= box;
+	}
+
+	if(image.channels() == 3)
+		cvtColor(image(area), grey, COLOR_BGR2GRAY);
+	else
+		image(area).copyTo(grey);
+	offset = area.tl();
+}
+
+void CalibrationViews::add(const vector< vector< Point2f > > &corners, const vector< int > &ids,
+	const Mat &charucoCorners, const Mat &charucoIds, const Mat &image) {
+	Mat grey;
+	Point offset;
+	compactView(corners, image, crop, grey, offset);
+	add(corners, ids, charucoCorners.clone(), charucoIds.clone(), grey, offset, image.size());
+}
+
+void CalibrationViews::add(const vector< vector< Point2f > > &corners, const vector< int > &ids,
+	const Mat &charucoCorners, const Mat &charucoIds, const Mat &grey, Point offset, Size imageSize) {
+	markers.add(corners, ids);
+	initialCharucoCorners.push_back(charucoCorners);
+	initialCharucoIds.push_back(charucoIds);
+	allImgs.push_back(grey);
+	allOffsets.push_back(offset);
+	imgSize = imageSize;
+}
+
+void CalibrationViews::reserve(int views, int markersPerView) {
+	markers.reserve(views, markersPerView);
+	initialCharucoCorners.reserve(views);
+	initialCharucoIds.reserve(views);
+	allImgs.reserve(views);
+	allOffsets.reserve(views);
+}
+
+void CalibrationViews::releaseImages() {
+	for(size_t i = 0; i < allImgs.size(); i++)
+		allImgs[i].release();
+}
+
+size_t CalibrationViews::imageBytes() const {
+	size_t bytes = 0;
+	for(size_t i = 0; i < allImgs.size(); i++)
+		bytes += allImgs[i].total() * allImgs[i].elemSize();
+	return bytes;
+}
+
+namespace {
+	// corners interpolateCornersCharuco can return at most: those with both neighbouring markers detected
+	// counts the corners whose nearest markers are both among ids, the ones interpolation can place
+	class CornerCounter {
+	public:
+		virtual ~CornerCounter() {}
+		virtual int interpolable(const int *ids, int count) const = 0;
+	};
+
+	class BoardCornerCounter : public CornerCounter {
+	public:
+		explicit BoardCornerCounter(const Ptr< aruco::CharucoBoard > &charBoard) : charBoard(charBoard) {}
+
+		int interpolable(const int *ids, int count) const override {
+			vector< bool > detected(charBoard->ids.size(), false);
+			for(int i = 0; i < count; i++) {
+				vector< int >::const_iterator it = find(charBoard->ids.begin(), charBoard->ids.end(), ids[i]);
+				if(it != charBoard->ids.end())
+					detected[it - charBoard->ids.begin()] = true;
+			}
+			int n = 0;
+			for(size_t c = 0; c < charBoard->nearestMarkerIdx.size(); c++) {
+				int found = 0;
+				for(size_t k = 0; k < charBoard->nearestMarkerIdx[c].size(); k++)
+					found += detected[charBoard->nearestMarkerIdx[c][k]] ? 1 : 0;
+				if(found >= 2)
+					n++;
+			}
+			return n;
+		}
+
+	private:
+		Ptr< aruco::CharucoBoard > charBoard;
+	};
+
+	// the board sizes in use get fixed-size tables: a bit per marker and, per corner,
+	// the mask of its two markers, so a view is counted without searching the ids
+	template< int W, int H > class FixedCornerCounter : public CornerCounter {
+	public:
+		static const int markerCount = W * H / 2, cornerCount = (W - 1) * (H - 1);
+		static_assert(markerCount <= 32, "markers must fit a 32 bit mask");
+
+		// false unless the board has this size and consecutive ids
+		bool init(const Ptr< aruco::CharucoBoard > &charBoard) {
+			if(charBoard->getChessboardSize() != Size(W, H) || (int)charBoard->ids.size() != markerCount ||
+				(int)charBoard->nearestMarkerIdx.size() != cornerCount)
+				return false;
+			firstId = charBoard->ids[0];
+			for(int m = 0; m < markerCount; m++)
+				if(charBoard->ids[m] != firstId + m)
+					return false;
+			for(int c = 0; c < cornerCount; c++) {
+				const vector< int > &nearest = charBoard->nearestMarkerIdx[c];
+				if(nearest.size() != 2)
+					return false;
+				masks[c] = (1u << nearest[0]) | (1u << nearest[1]);
+			}
+			return true;
+		}
+
+		int interpolable(const int *ids, int count) const override {
+			uint32_t seen = 0;
+			for(int i = 0; i < count; i++) {
+				unsigned k = (unsigned)(ids[i] - firstId);
+				if(k < (unsigned)markerCount)
+					seen |= 1u << k;
+			}
+			int n = 0;
+			for(int c = 0; c < cornerCount; c++)
+				n += (masks[c] & seen) == masks[c];
+			return n;
+		}
+
+	private:
+		int firstId;
+		uint32_t masks[cornerCount];
+	};
+
+	template< int W, int H > unique_ptr< CornerCounter > fixedCounter(const Ptr< aruco::CharucoBoard > &charBoard) {
+		unique_ptr< FixedCornerCounter< W, H > > counter(new FixedCornerCounter< W, H >);
+		if(!counter->init(charBoard))
+			return unique_ptr< CornerCounter >();
+		return counter;
+	}
+
+	// 5x7, 7x7 and 8x5 (in either orientation) are the boards we print
+	unique_ptr< CornerCounter > makeCornerCounter(const Ptr< aruco::CharucoBoard > &charBoard) {
+		unique_ptr< CornerCounter > counter;
+		Size squares = charBoard->getChessboardSize();
+		if(squares == Size(5, 7))
+			counter = fixedCounter< 5, 7 >(charBoard);
+		else if(squares == Size(7, 7))
+			counter = fixedCounter< 7, 7 >(charBoard);
+		else if(squares == Size(7, 5))
+			counter = fixedCounter< 7, 5 >(charBoard);
+		else if(squares == Size(8, 5))
+			counter = fixedCounter< 8, 5 >(charBoard);
+		else if(squares == Size(5, 8))
+			counter = fixedCounter< 5, 8 >(charBoard);
+		if(!counter)
+			counter.reset(new BoardCornerCounter(charBoard));
+		return counter;
+	}
+
+	void interpolateView(const CalibrationViews &views, int i, const Ptr< aruco::CharucoBoard > &charBoard,
+		const Mat &cameraMatrix, const Mat &distCoeffs, Mat &charucoCorners, Mat &charucoIds) {
+		// the stored image is cropped, so work in its coordinates: shifting the principal
+		// point moves the projection exactly, distortion is applied before it
+		Point2f offset((float)views.allOffsets[i].x, (float)views.allOffsets[i].y);
+		int n = views.markers.markers(i);
+		const Point2f *corners = views.markers.viewCorners(i);
+		Mat shifted(1, 4 * n, CV_32FC2);
+		for(int c = 0; c < 4 * n; c++)
+			shifted.ptr< Point2f >(0)[c] = corners[c] - offset;
+		vector< Mat > localCorners(n);
+		for(int m = 0; m < n; m++)
+			localCorners[m] = shifted.colRange(4 * m, 4 * m + 4);
+		Mat ids(1, n, CV_32S, (void *)views.markers.viewIds(i));
+		Mat localCamera = cameraMatrix.clone();
+		localCamera.at< double >(0, 2) -= offset.x;
+		localCamera.at< double >(1, 2) -= offset.y;
+
+		// interpolate using camera parameters
+		aruco::interpolateCornersCharuco(localCorners, ids, views.allImgs[i], charBoard,
+			charucoCorners, charucoIds, localCamera, distCoeffs);
+		for(int c = 0; c < (int)charucoCorners.total(); c++)
+			charucoCorners.ptr< Point2f >(0)[c] += offset;
+	}
+}
+
+bool calibrateCharuco(const CalibrationViews &views, const Ptr< aruco::CharucoBoard > &charBoard,
+	int calibrationFlags, double aspectRatio, CalibrationResult &result, bool warmStart) {
+	const ViewStore &markers = views.markers;
+	Ptr< aruco::Board > board = charBoard.staticCast< aruco::Board >();
+
+	if(markers.size() < 1) {
+		cerr << "Not enough captures for calibration" << endl;
+		return false;
+	}
+
+	Mat &cameraMatrix = result.cameraMatrix, &distCoeffs = result.distCoeffs;
+	result.arucoRepErr = -1;
+	// an online estimate is already a better camera model than the marker calibration
+	if(!warmStart) {
+		if(calibrationFlags & CALIB_FIX_ASPECT_RATIO) {
+			cameraMatrix = Mat::eye(3, 3, CV_64F);
+			cameraMatrix.at< double >(0, 0) = aspectRatio;
+		}
+
+		// the store is already laid out as calibrateCameraAruco wants it, only headers are made
+		vector< Mat > cornerHeaders;
+		markers.headers(0, markers.totalMarkers(), cornerHeaders);
+
+		// calibrate camera using aruco markers
+		ScopedTimer timer(Stats::CALIB_ARUCO);
+		result.arucoRepErr = aruco::calibrateCameraAruco(cornerHeaders, markers.ids,
+			markers.counts, board, views.imgSize, cameraMatrix,
+			distCoeffs, noArray(), noArray(), calibrationFlags);
+	}
+
+	// prepare data for charuco calibration
+	int nFrames = markers.size();
+	vector< Mat > &allCharucoCorners = result.allCharucoCorners;
+	vector< Mat > &allCharucoIds = result.allCharucoIds;
+	allCharucoCorners.assign(nFrames, Mat());
+	allCharucoIds.assign(nFrames, Mat());
+
+	// views interpolate independently, each writing only its own slot
+	unique_ptr< CornerCounter > counter = makeCornerCounter(charBoard);
+	vector< uchar > reinterpolated(nFrames, 0);
+	parallel_for_(Range(0, nFrames), [&](const Range &range) {
+		for(int i = range.start; i < range.end; i++) {
+			const Mat &initial = views.initialCharucoCorners[i];
+			// the camera model could only move corners already found, cornerSubPix settles them the same
+			if(views.allImgs[i].empty() ||
+				(!initial.empty() && (int)initial.total() == counter->interpolable(markers.viewIds(i), markers.markers(i)))) {
+				allCharucoCorners[i] = initial;
+				allCharucoIds[i] = views.initialCharucoIds[i];
+				continue;
+			}
+			interpolateView(views, i, charBoard, cameraMatrix, distCoeffs, allCharucoCorners[i], allCharucoIds[i]);
+			reinterpolated[i] = 1;
+		}
+	});
+	cout << "Charuco interpolation with camera model: " << countNonZero(reinterpolated) << " of " << nFrames
+		<< " views, the rest were already complete" << endl;
+
+	if(allCharucoCorners.size() < 4) {
+		cerr << "Not enough corners for calibration" << endl;
+		return false;
+	}
+
+	// calibrate camera using charuco
+	ScopedTimer timer(Stats::CALIB_CHARUCO);
+	result.repError =
+		aruco::calibrateCameraCharuco(allCharucoCorners, allCharucoIds, charBoard, views.imgSize,
+			cameraMatrix, distCoeffs, result.rvecs, result.tvecs,
+			warmStart ? calibrationFlags | CALIB_USE_INTRINSIC_GUESS : calibrationFlags);
+	result.keptViews.resize(nFrames);
+	for(int i = 0; i < nFrames; i++)
+		result.keptViews[i] = i;
+	result.viewErrors.clear();
+	return true;
+}
+
+namespace {
+	struct ViewSolve {
+		vector< int > views;
+		Mat cameraMatrix, distCoeffs;
+		vector< Mat > rvecs, tvecs;
+		double error;
+	};
+
+	void solveViews(const CalibrationResult &result, const Ptr< aruco::CharucoBoard > &charBoard, Size imageSize,
+		int flags, TermCriteria criteria, ViewSolve &solve) {
+		vector< Mat > corners, ids;
+		for(size_t i = 0; i < solve.views.size(); i++) {
+			corners.push_back(result.allCharucoCorners[solve.views[i]]);
+			ids.push_back(result.allCharucoIds[solve.views[i]]);
+		}
+		solve.error = aruco::calibrateCameraCharuco(corners, ids, charBoard, imageSize, solve.cameraMatrix,
+			solve.distCoeffs, solve.rvecs, solve.tvecs, flags | CALIB_USE_INTRINSIC_GUESS, criteria);
+	}
+
+	// rms reprojection error of every solved view under its own pose
+	void viewErrors(const CalibrationResult &result, const Ptr< aruco::CharucoBoard > &charBoard,
+		const ViewSolve &solve, vector< double > &errors) {
+		errors.assign(solve.views.size(), 0);
+		parallel_for_(Range(0, (int)solve.views.size()), [&](const Range &range) {
+			vector< Point3f > object;
+			vector< Point2f > projected;
+			for(int i = range.start; i < range.end; i++) {
+				const Mat &corners = result.allCharucoCorners[solve.views[i]];
+				const Mat &ids = result.allCharucoIds[solve.views[i]];
+				object.clear();
+				for(int c = 0; c < (int)ids.total(); c++)
+					object.push_back(charBoard->chessboardCorners[ids.at< int >(c)]);
+				if(object.empty())
+					continue;
+				projectPoints(object, solve.rvecs[i], solve.tvecs[i], solve.cameraMatrix, solve.distCoeffs, projected);
+				double sum = 0;
+				for(size_t c = 0; c < projected.size(); c++) {
+					Point2f d = projected[c] - corners.at< Point2f >((int)c);
+					sum += d.dot(d);
+				}
+				errors[i] = sqrt(sum / projected.size());
+			}
+		});
+	}
+
+	double median(vector< double > values) {
+		nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+		return values[values.size() / 2];
+	}
+}
+
+void rejectOutlierViews(const Ptr< aruco::CharucoBoard > &charBoard, Size imageSize, int calibrationFlags,
+	CalibrationResult &result, double minGain) {
+	ScopedTimer timer(Stats::CALIB_CHARUCO);
+	ViewSolve current;
+	current.views = result.keptViews;
+	current.cameraMatrix = result.cameraMatrix;
+	current.distCoeffs = result.distCoeffs;
+	current.rvecs = result.rvecs;
+	current.tvecs = result.tvecs;
+	current.error = result.repError;
+	int total = (int)current.views.size();
+	int minViews = max(4, (total + 1) / 2);
+	// candidates start from a converged model, they need far fewer iterations than the first solve
+	TermCriteria criteria(TermCriteria::COUNT + TermCriteria::EPS, 15, 1e-6);
+	const double thresholds[] = { 3, 2.5, 2 };
+
+	vector< double > errors;
+	viewErrors(result, charBoard, current, errors);
+	for(int round = 0; round < 5; round++) {
+		double mid = median(errors);
+		vector< double > deviations(errors.size());
+		for(size_t i = 0; i < errors.size(); i++)
+			deviations[i] = fabs(errors[i] - mid);
+		double spread = max(1.4826 * median(deviations), 1e-3);
+
+		vector< ViewSolve > candidates;
+		for(size_t t = 0; t < sizeof(thresholds) / sizeof(thresholds[0]); t++) {
+			ViewSolve candidate;
+			for(size_t i = 0; i < errors.size(); i++)
+				if(errors[i] <= mid + thresholds[t] * spread)
+					candidate.views.push_back(current.views[i]);
+			if(candidate.views.size() == current.views.size() || (int)candidate.views.size() < minViews ||
+				(!candidates.empty() && candidates.back().views.size() == candidate.views.size()))
+				continue;
+			candidates.push_back(candidate);
+		}
+		if(candidates.empty())
+			break;
+
+		// subsets are independent solves from the same starting model
+		parallel_for_(Range(0, (int)candidates.size()), [&](const Range &range) {
+			for(int c = range.start; c < range.end; c++) {
+				candidates[c].cameraMatrix = current.cameraMatrix.clone();
+				candidates[c].distCoeffs = current.distCoeffs.clone();
+				solveViews(result, charBoard, imageSize, calibrationFlags, criteria, candidates[c]);
+			}
+		});
+		// the lowest error wins, but a subset within 1% of it that keeps more views is preferred
+		int best = 0;
+		for(int c = 1; c < (int)candidates.size(); c++)
+			if(candidates[c].error < candidates[best].error)
+				best = c;
+		for(int c = 0; c < best; c++)
+			if(candidates[c].error <= candidates[best].error * 1.01) {
+				best = c;
+				break;
+			}
+		cout << "Robust calibration round " << round + 1 << ": " << candidates[best].views.size() << " of " << total
+			<< " views, rep error " << current.error << " -> " << candidates[best].error << endl;
+		if(candidates[best].error > current.error * (1 - minGain))
+			break;
+		current = candidates[best];
+		viewErrors(result, charBoard, current, errors);
+	}
+
+	result.cameraMatrix = current.cameraMatrix;
+	result.distCoeffs = current.distCoeffs;
+	result.rvecs = current.rvecs;
+	result.tvecs = current.tvecs;
+	result.repError = current.error;
+	result.keptViews = current.views;
+	result.viewErrors = errors;
+	cout << "Robust calibration kept " << current.views.size() << " of " << total << " views" << endl;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <vector>
+#include "viewStore.h"
+
+// Views accepted for calibration: the markers detected in each frame (in a flat
+// ViewStore), the charuco
+// corners interpolated from them without a camera model, and a grey copy of the
+// frame, which interpolation needs again once a camera model exists. With cropping
+// only the board region is kept, allOffsets holding where it sits in the full frame.
+struct CalibrationViews {
+	CalibrationViews() : crop(true) {}
+
+	// the frame and charuco corners are copied, callers may reuse them afterwards
+	void add(const std::vector< std::vector< cv::Point2f > > &corners, const std::vector< int > &ids,
+		const cv::Mat &charucoCorners, const cv::Mat &charucoIds, const cv::Mat &image);
+	// add a view already reduced by compactView
+	void add(const std::vector< std::vector< cv::Point2f > > &corners, const std::vector< int > &ids,
+		const cv::Mat &charucoCorners, const cv::Mat &charucoIds, const cv::Mat &grey, cv::Point offset,
+		cv::Size imageSize);
+	int size() const { return markers.size(); }
+	void reserve(int views, int markersPerView);
+	// drop the stored images once nothing needs them anymore
+	void releaseImages();
+	size_t imageBytes() const;
+
+	bool crop;
+	ViewStore markers;
+	std::vector< cv::Mat > initialCharucoCorners, initialCharucoIds;
+	std::vector< cv::Mat > allImgs;
+	std::vector< cv::Point > allOffsets;
+	cv::Size imgSize;
+};
+
+// grey copy of image, only of the region around the markers when crop is set
+void compactView(const std::vector< std::vector< cv::Point2f > > &corners, const cv::Mat &image, bool crop,
+	cv::Mat &grey, cv::Point &offset);
+
+struct CalibrationResult {
+	cv::Mat cameraMatrix, distCoeffs;
+	std::vector< cv::Mat > rvecs, tvecs;
+	std::vector< cv::Mat > allCharucoCorners, allCharucoIds;
+	double arucoRepErr, repError;
+	// views the solve used, rvecs/tvecs and viewErrors (rms in pixels) follow their order;
+	// every view unless rejectOutlierViews dropped some
+	std::vector< int > keptViews;
+	std::vector< double > viewErrors;
+};
+
+// Calibrates from the marker corners to get a camera model, interpolates the
+// charuco corners of every view with it (in parallel, skipping views whose
+// initial interpolation already found every corner their markers allow) and
+// refines the calibration on those. With warmStart, result already holds an
+// estimate (e.g. from OnlineCalibrator) which replaces the marker calibration
+// and initialises the charuco solve.
+bool calibrateCharuco(const CalibrationViews &views, const cv::Ptr< cv::aruco::CharucoBoard > &charBoard,
+	int calibrationFlags, double aspectRatio, CalibrationResult &result, bool warmStart = false);
+
+// Robust refinement of a calibrateCharuco result: views whose reprojection error
+// lies far above the median (several MAD thresholds, each a candidate subset
+// solved concurrently from the current model) are dropped and the best subset
+// kept, until no view stands out or dropping stops improving the error by at
+// least minGain. At least half of the views, and four, are always kept.
+void rejectOutlierViews(const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, cv::Size imageSize,
+	int calibrationFlags, CalibrationResult &result, double minGain = 0.02);
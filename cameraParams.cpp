@@ -0,0 +1,202 @@
+#include "cameraParams.h"
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const char magic[8] = { 'C', 'H', 'A', 'R', 'C', 'A', 'M', 'P' };
+	const uint32_t version = 1;
+	const int maxDistCoeffs = 14;
+	const int headerSize = 512;
+	const int blockAlign = 64;
+
+	// fields at fixed offsets, every member naturally aligned
+	struct BinaryHeader {
+		char magic[8];
+		uint32_t version, headerBytes;
+		int32_t width, height;
+		int32_t flags, distCount;
+		double aspectRatio, repError;
+		double cameraMatrix[9];
+		double distCoeffs[maxDistCoeffs];
+		// map1 CV_16SC2 and map2 CV_16UC1 of width x height, or no maps when 0
+		int32_t mapWidth, mapHeight;
+		uint64_t map1Offset, map1Bytes, map2Offset, map2Bytes;
+	};
+
+	uint64_t aligned(uint64_t offset) {
+		return (offset + blockAlign - 1) / blockAlign * blockAlign;
+	}
+
+	bool writeBlock(FILE *f, uint64_t offset, const Mat &m) {
+		if(fseek(f, (long)offset, SEEK_SET) != 0)
+			return false;
+		size_t rowBytes = m.cols * m.elemSize();
+		for(int y = 0; y < m.rows; y++)
+			if(fwrite(m.ptr(y), 1, rowBytes, f) != rowBytes)
+				return false;
+		return true;
+	}
+
+	bool readBlock(FILE *f, uint64_t offset, uint64_t bytes, Mat &m) {
+		if(bytes != m.total() * m.elemSize() || fseek(f, (long)offset, SEEK_SET) != 0)
+			return false;
+		return fread(m.data, 1, (size_t)bytes, f) == bytes;
+	}
+
+	void writeCameraParams(FileStorage &fs, Size imageSize, float aspectRatio, int flags, const Mat &cameraMatrix,
+		const Mat &distCoeffs, double totalAvgErr) {
+		time_t tt;
+		time(&tt);
+		struct tm *t2 = localtime(&tt);
+		char buf[1024];
+		strftime(buf, sizeof(buf) - 1, "%c", t2);
+		fs << "calibration_time" << buf;
+		fs << "image_width" << imageSize.width;
+		fs << "image_height" << imageSize.height;
+		if(flags & CALIB_FIX_ASPECT_RATIO) fs << "aspectRatio" << aspectRatio;
+		if(flags != 0) {
+			sprintf(buf, "flags: %s%s%s%s",
+				flags & CALIB_USE_INTRINSIC_GUESS ? "+use_intrinsic_guess" : "",
+				flags & CALIB_FIX_ASPECT_RATIO ? "+fix_aspectRatio" : "",
+				flags & CALIB_FIX_PRINCIPAL_POINT ? "+fix_principal_point" : "",
+				flags & CALIB_ZERO_TANGENT_DIST ? "+zero_tangent_dist" : "");
+		}
+		fs << "flags" << flags;
+		fs << "camera_matrix" << cameraMatrix;
+		fs << "distortion_coefficients" << distCoeffs;
+		fs << "avg_reprojection_error" << totalAvgErr;
+	}
+}
+
+bool saveCameraParams(const string &filename, Size imageSize, float aspectRatio, int flags,
+	const Mat &cameraMatrix, const Mat &distCoeffs, double totalAvgErr) {
+	FileStorage fs(filename, FileStorage::WRITE);
+	if(!fs.isOpened())
+		return false;
+	writeCameraParams(fs, imageSize, aspectRatio, flags, cameraMatrix, distCoeffs, totalAvgErr);
+	return true;
+}
+
+string cameraParamsText(Size imageSize, float aspectRatio, int flags, const Mat &cameraMatrix,
+	const Mat &distCoeffs, double totalAvgErr) {
+	FileStorage fs(".yml", FileStorage::WRITE | FileStorage::MEMORY);
+	writeCameraParams(fs, imageSize, aspectRatio, flags, cameraMatrix, distCoeffs, totalAvgErr);
+	return fs.releaseAndGetString();
+}
+
+
+bool saveCameraParamsBinary(const string &filename, Size imageSize, float aspectRatio, int flags,
+	const Mat &cameraMatrix, const Mat &distCoeffs, double totalAvgErr, bool withMaps) {
+	Mat K, D;
+	cameraMatrix.convertTo(K, CV_64F);
+	distCoeffs.convertTo(D, CV_64F);
+	if(K.total() != 9 || (int)D.total() > maxDistCoeffs)
+		return false;
+
+	static_assert(sizeof(BinaryHeader) <= headerSize, "binary camera header outgrew its block");
+	BinaryHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = version;
+	h.headerBytes = headerSize;
+	h.width = imageSize.width;
+	h.height = imageSize.height;
+	h.flags = flags;
+	h.distCount = (int32_t)D.total();
+	h.aspectRatio = aspectRatio;
+	h.repError = totalAvgErr;
+	for(int i = 0; i < 9; i++)
+		h.cameraMatrix[i] = K.at< double >(i / 3, i % 3);
+	for(int i = 0; i < h.distCount; i++)
+		h.distCoeffs[i] = D.ptr< double >()[i];
+
+	// the maps a consumer would otherwise compute at startup, same camera matrix, no rectification
+	Mat map1, map2;
+	if(withMaps) {
+		initUndistortRectifyMap(K, D, Mat(), K, imageSize, CV_16SC2, map1, map2);
+		h.mapWidth = imageSize.width;
+		h.mapHeight = imageSize.height;
+		h.map1Offset = aligned(headerSize);
+		h.map1Bytes = map1.total() * map1.elemSize();
+		h.map2Offset = aligned(h.map1Offset + h.map1Bytes);
+		h.map2Bytes = map2.total() * map2.elemSize();
+	}
+
+	FILE *f = fopen(filename.c_str(), "wb");
+	if(!f)
+		return false;
+	vector< char > header(headerSize, 0);
+	memcpy(header.data(), &h, sizeof(h));
+	bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+	if(ok && withMaps)
+		ok = writeBlock(f, h.map1Offset, map1) && writeBlock(f, h.map2Offset, map2);
+	return fclose(f) == 0 && ok;
+}
+
+bool loadCameraParamsBinary(const string &filename, CameraParams &params, bool withMaps) {
+	FILE *f = fopen(filename.c_str(), "rb");
+	if(!f)
+		return false;
+	BinaryHeader h;
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, magic, sizeof(magic)) == 0 &&
+		h.version == version && h.distCount >= 0 && h.distCount <= maxDistCoeffs;
+	if(!ok) {
+		cerr << filename << " is not a binary camera parameter file of this version" << endl;
+		fclose(f);
+		return false;
+	}
+	params.imageSize = Size(h.width, h.height);
+	params.flags = h.flags;
+	params.aspectRatio = h.aspectRatio;
+	params.repError = h.repError;
+	Mat(3, 3, CV_64F, h.cameraMatrix).copyTo(params.cameraMatrix);
+	Mat(1, h.distCount, CV_64F, h.distCoeffs).copyTo(params.distCoeffs);
+	params.map1.release();
+	params.map2.release();
+	if(withMaps && h.mapWidth > 0 && h.mapHeight > 0) {
+		params.map1.create(h.mapHeight, h.mapWidth, CV_16SC2);
+		params.map2.create(h.mapHeight, h.mapWidth, CV_16UC1);
+		ok = readBlock(f, h.map1Offset, h.map1Bytes, params.map1) &&
+			readBlock(f, h.map2Offset, h.map2Bytes, params.map2);
+	}
+	fclose(f);
+	return ok;
+}
+
+bool loadCameraParams(const string &filename, CameraParams &params) {
+	FILE *f = fopen(filename.c_str(), "rb");
+	if(!f) {
+		cerr << "Cannot open " << filename << endl;
+		return false;
+	}
+	char head[sizeof(magic)];
+	bool binary = fread(head, 1, sizeof(head), f) == sizeof(head) && memcmp(head, magic, sizeof(magic)) == 0;
+	fclose(f);
+	if(binary)
+		return loadCameraParamsBinary(filename, params, false);
+
+	FileStorage fs(filename, FileStorage::READ);
+	if(!fs.isOpened())
+		return false;
+	params.imageSize = Size((int)fs["image_width"], (int)fs["image_height"]);
+	params.flags = (int)fs["flags"];
+	params.aspectRatio = fs["aspectRatio"].empty() ? 1. : (double)fs["aspectRatio"];
+	params.repError = (double)fs["avg_reprojection_error"];
+	fs["camera_matrix"] >> params.cameraMatrix;
+	fs["distortion_coefficients"] >> params.distCoeffs;
+	params.map1.release();
+	params.map2.release();
+	if(params.cameraMatrix.total() != 9) {
+		cerr << filename << " holds no camera matrix" << endl;
+		return false;
+	}
+	return true;
+}
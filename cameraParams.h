@@ -0,0 +1,30 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <string>
+
+// calibration result as FileStorage YAML/XML
+bool saveCameraParams(const std::string &filename, cv::Size imageSize, float aspectRatio, int flags,
+	const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, double totalAvgErr);
+// the same YAML as text
+std::string cameraParamsText(cv::Size imageSize, float aspectRatio, int flags, const cv::Mat &cameraMatrix,
+	const cv::Mat &distCoeffs, double totalAvgErr);
+
+// A calibration as read back from the binary format: the parameters and, when
+// the file carries them, the undistortion maps initUndistortRectifyMap gives for
+// them (CV_16SC2 and CV_16UC1, ready for remap).
+struct CameraParams {
+	cv::Size imageSize;
+	int flags;
+	double aspectRatio, repError;
+	cv::Mat cameraMatrix, distCoeffs;
+	cv::Mat map1, map2;
+};
+
+// Writes the calibration in a fixed, versioned little-endian layout: a 512 byte
+// header with the parameters and the offsets of the map blocks, each block 64 byte
+// aligned, so a consumer can map the file and point Mats at the maps directly.
+bool saveCameraParamsBinary(const std::string &filename, cv::Size imageSize, float aspectRatio, int flags,
+	const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, double totalAvgErr, bool withMaps = true);
+bool loadCameraParamsBinary(const std::string &filename, CameraParams &params, bool withMaps = true);
+// either format, told apart by the binary magic; the maps are not loaded
+bool loadCameraParams(const std::string &filename, CameraParams &params);
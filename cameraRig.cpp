@@ -0,0 +1,230 @@
+#include "cameraRig.h"
+#include <opencv2/calib3d.hpp>
+#include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "pipeline.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+vector< string > splitSources(const string &list) {
+	vector< string > sources;
+	stringstream in(list);
+	string item;
+	while(getline(in, item, ','))
+		if(!item.empty())
+			sources.push_back(item);
+	return sources;
+}
+
+bool PairViews::add(const Ptr< aruco::CharucoBoard > &charBoard, const Mat &firstCorners, const Mat &firstIds,
+	const Mat &secondCorners, const Mat &secondIds, int minShared) {
+	vector< Point3f > object;
+	vector< Point2f > a, b;
+	for(int i = 0; i < (int)firstIds.total(); i++) {
+		int id = firstIds.at< int >(i);
+		for(int j = 0; j < (int)secondIds.total(); j++)
+			if(secondIds.at< int >(j) == id) {
+				object.push_back(charBoard->chessboardCorners[id]);
+				a.push_back(firstCorners.at< Point2f >(i));
+				b.push_back(secondCorners.at< Point2f >(j));
+				break;
+			}
+	}
+	if((int)object.size() < minShared)
+		return false;
+	objectPoints.push_back(object);
+	firstPoints.push_back(a);
+	secondPoints.push_back(b);
+	return true;
+}
+
+bool calibratePair(const PairViews &pair, const CalibrationResult &first, const CalibrationResult &second,
+	Size imageSize, StereoResult &result) {
+	if(pair.size() < 3) {
+		cerr << "Cameras " << pair.first << " and " << pair.second << ": only " << pair.size()
+			<< " shared views, not enough for stereo calibration" << endl;
+		return false;
+	}
+	Mat firstCamera = first.cameraMatrix.clone(), firstDist = first.distCoeffs.clone();
+	Mat secondCamera = second.cameraMatrix.clone(), secondDist = second.distCoeffs.clone();
+	result.repError = stereoCalibrate(pair.objectPoints, pair.firstPoints, pair.secondPoints,
+		firstCamera, firstDist, secondCamera, secondDist, imageSize, result.R, result.T, result.E, result.F,
+		CALIB_FIX_INTRINSIC);
+	return true;
+}
+
+bool CameraRig::open(const vector< string > &sources, Size frameSize, double fps) {
+	caps.clear();
+	fromVideo = false;
+	for(size_t i = 0; i < sources.size(); i++) {
+		caps.push_back(unique_ptr< VideoCapture >(new VideoCapture));
+		VideoCapture &cap = *caps.back();
+		const string &source = sources[i];
+		if(source.find_first_not_of("0123456789") == string::npos) {
+			cap.open(atoi(source.c_str()));
+			cap.set(CAP_PROP_FRAME_WIDTH, frameSize.width);
+			cap.set(CAP_PROP_FRAME_HEIGHT, frameSize.height);
+			if(fps > 0)
+				cap.set(CAP_PROP_FPS, fps);
+		}
+		else {
+			cap.open(source);
+			fromVideo = true;
+		}
+		if(!cap.isOpened()) {
+			cerr << "Cannot open rig source " << source << endl;
+			return false;
+		}
+	}
+	return !caps.empty();
+}
+
+void CameraRig::grabSets(vector< unique_ptr< FrameRing > > &rings, const atomic< bool > &running,
+	double maxSkewMs) {
+	int n = size();
+	vector< Mat > frames(n);
+	vector< double > grabMs(n), driverMs(n);
+	chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+	for(;;) {
+		bool grabbed = running;
+		{
+			ScopedTimer timer(Stats::GRAB);
+			for(int i = 0; i < n && grabbed; i++) {
+				grabbed = caps[i]->grab();
+				chrono::duration< double, milli > ms = chrono::steady_clock::now() - origin;
+				grabMs[i] = ms.count();
+			}
+		}
+		if(!grabbed)
+			break;
+		bool driverStamps = true;
+		for(int i = 0; i < n; i++) {
+			driverMs[i] = caps[i]->get(CAP_PROP_POS_MSEC);
+			driverStamps = driverStamps && driverMs[i] > 0;
+		}
+		{
+			ScopedTimer timer(Stats::RETRIEVE);
+			for(int i = 0; i < n; i++)
+				caps[i]->retrieve(frames[i]);
+		}
+
+		const vector< double > &stamps = driverStamps ? driverMs : grabMs;
+		double spread = *max_element(stamps.begin(), stamps.end()) - *min_element(stamps.begin(), stamps.end());
+		if(spread > maxSkewMs) {
+			nSkipped++;
+			continue;
+		}
+		// every ring receives every set, so the k-th frame out of each pipeline belongs to set k
+		for(int i = 0; i < n; i++)
+			rings[i]->push(frames[i]);
+		nSets++;
+	}
+	for(int i = 0; i < n; i++)
+		rings[i]->close();
+}
+
+void CameraRig::capture(const MarkerDetector &detector, const Ptr< aruco::CharucoBoard > &charBoard,
+	const RigOptions &options, vector< KeyframeSelector > *selectors, vector< CalibrationViews > &views,
+	vector< PairViews > &pairs) {
+	int n = size();
+	int waitTime = fromVideo ? 0 : 1;
+
+	// sets are never dropped by the rings, a dropped frame would shift one camera against the others
+	vector< unique_ptr< FrameRing > > rings;
+	vector< unique_ptr< MarkerDetector > > detectors;
+	vector< unique_ptr< DetectionPipeline > > pipelines;
+	for(int i = 0; i < n; i++) {
+		Size frameSize((int)caps[i]->get(CAP_PROP_FRAME_WIDTH), (int)caps[i]->get(CAP_PROP_FRAME_HEIGHT));
+		rings.push_back(unique_ptr< FrameRing >(new FrameRing(options.ringDepth, frameSize, CV_8UC3, false)));
+		detectors.push_back(unique_ptr< MarkerDetector >(new MarkerDetector(detector)));
+		pipelines.push_back(unique_ptr< DetectionPipeline >(new DetectionPipeline(*rings[i], *detectors[i],
+			charBoard, options.refineStrategy, 8)));
+		pipelines[i]->setPreview(options.previewScale, options.previewEvery, options.openCL);
+	}
+	pairs.clear();
+	for(int a = 0; a < n; a++)
+		for(int b = a + 1; b < n; b++)
+			pairs.push_back(PairViews(a, b));
+
+	atomic< bool > capturing(true);
+	thread grabThread(&CameraRig::grabSets, this, ref(rings), cref(capturing), options.maxSkewMs);
+	for(int i = 0; i < n; i++)
+		pipelines[i]->start();
+	if(options.previewEvery > 0)
+		cout << "Press 'c' to add the current frame set. 'ESC' to finish and calibrate" << endl;
+
+	vector< FrameJob * > jobs(n);
+	for(;;) {
+		bool complete = true;
+		for(int i = 0; i < n; i++) {
+			jobs[i] = pipelines[i]->next();
+			complete = complete && jobs[i] != 0;
+		}
+		char key = -1;
+		bool shown = false;
+		for(int i = 0; i < n && complete; i++)
+			if(jobs[i]->preview) {
+				ostringstream window;
+				window << "cam " << i;
+				ScopedTimer timer(Stats::IMSHOW);
+				imshow(window.str(), jobs[i]->display);
+				shown = true;
+			}
+		if(shown)
+			key = (char)waitKey(waitTime);
+
+		bool done = !complete || key == 27;
+		vector< bool > kept(n, false);
+		bool anyKept = false;
+		for(int i = 0; i < n && !done; i++) {
+			FrameJob &job = *jobs[i];
+			if(selectors)
+				kept[i] = (*selectors)[i].consider(job.charucoCorners, job.charucoIds, job.image.size());
+			else
+				kept[i] = key == 'c' && !job.ids.empty();
+			if(kept[i])
+				views[i].add(job.corners, job.ids, job.charucoCorners, job.charucoIds, job.image);
+			anyKept = anyKept || kept[i];
+		}
+		if(anyKept) {
+			ostringstream status;
+			status << "Set " << nSets << " kept:";
+			for(int i = 0; i < n; i++)
+				status << " cam " << i << " " << views[i].size();
+			for(size_t p = 0; p < pairs.size(); p++) {
+				const FrameJob &a = *jobs[pairs[p].first], &b = *jobs[pairs[p].second];
+				if(pairs[p].add(charBoard, a.charucoCorners, a.charucoIds, b.charucoCorners, b.charucoIds))
+					status << ", pair " << pairs[p].first << "-" << pairs[p].second << " " << pairs[p].size();
+			}
+			cout << status.str() << endl;
+		}
+		if(selectors && !done) {
+			done = true;
+			for(int i = 0; i < n; i++)
+				done = done && (*selectors)[i].full();
+			if(done)
+				cout << "View limit reached on every camera" << endl;
+		}
+		for(int i = 0; i < n; i++)
+			if(jobs[i])
+				pipelines[i]->release(jobs[i]);
+		if(done)
+			break;
+	}
+	capturing = false;
+	for(int i = 0; i < n; i++)
+		rings[i]->close();
+	grabThread.join();
+	for(int i = 0; i < n; i++) {
+		pipelines[i]->stop();
+		cout << "Camera " << i << ": ";
+		pipelines[i]->report(cout);
+	}
+	cout << "Synchronized sets: " << nSets << ", skipped for timestamp skew: " << nSkipped << endl;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <opencv2/videoio.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "calibration.h"
+#include "detector.h"
+#include "frameRing.h"
+#include "keyframe.h"
+
+// Charuco corners that two cameras of a rig both found in the same frame set,
+// with their board coordinates, as stereoCalibrate takes them.
+struct PairViews {
+	PairViews(int first, int second) : first(first), second(second) {}
+
+	// false when the views share fewer than minShared corners
+	bool add(const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, const cv::Mat &firstCorners,
+		const cv::Mat &firstIds, const cv::Mat &secondCorners, const cv::Mat &secondIds, int minShared = 6);
+	int size() const { return (int)objectPoints.size(); }
+
+	int first, second;
+	std::vector< std::vector< cv::Point3f > > objectPoints;
+	std::vector< std::vector< cv::Point2f > > firstPoints, secondPoints;
+};
+
+// second camera's pose relative to the first
+struct StereoResult {
+	cv::Mat R, T, E, F;
+	double repError;
+};
+
+// stereo calibration of a pair with both intrinsics fixed
+bool calibratePair(const PairViews &pair, const CalibrationResult &first, const CalibrationResult &second,
+	cv::Size imageSize, StereoResult &result);
+
+struct RigOptions {
+	// camera mode, fps 0 keeps the driver default; recordings keep theirs
+	cv::Size frameSize;
+	double fps;
+	int ringDepth;
+	bool refineStrategy;
+	// largest timestamp spread of a frame set still treated as simultaneous
+	double maxSkewMs;
+	double previewScale;
+	// 0 runs headless
+	int previewEvery;
+	bool openCL;
+};
+
+// Cameras (or recordings of them) capturing together. One thread grabs every
+// camera back to back and only then retrieves the frames, so a set's exposures
+// are as close as the cameras allow; each camera then has its own ring and
+// detection pipeline. Sets whose timestamps spread wider than maxSkewMs are
+// skipped. Driver timestamps (CAP_PROP_POS_MSEC) are used when every camera
+// reports one, the grab times otherwise.
+class CameraRig {
+public:
+	CameraRig() : fromVideo(false), nSets(0), nSkipped(0) {}
+
+	// sources are camera indices or video files, fps 0 keeps the driver default
+	bool open(const std::vector< std::string > &sources, cv::Size frameSize, double fps = 0);
+	int size() const { return (int)caps.size(); }
+
+	// views are kept per camera (by selector[i] when given, else on 'c') and every kept set
+	// adds the corners each pair of cameras shares to its PairViews
+	void capture(const MarkerDetector &detector, const cv::Ptr< cv::aruco::CharucoBoard > &charBoard,
+		const RigOptions &options, std::vector< KeyframeSelector > *selectors,
+		std::vector< CalibrationViews > &views, std::vector< PairViews > &pairs);
+
+private:
+	void grabSets(std::vector< std::unique_ptr< FrameRing > > &rings, const std::atomic< bool > &running,
+		double maxSkewMs);
+
+	std::vector< std::unique_ptr< cv::VideoCapture > > caps;
+	bool fromVideo;
+	std::atomic< int > nSets, nSkipped;
+};
+
+// comma separated list
+std::vector< std::string > splitSources(const std::string &list);
@@ -4,7 +4,29 @@
 #include <opencv2/imgproc.hpp>
 #include <vector>
 #include <iostream>
-#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include "allocCounter.h"
+#include "batch.h"
+#include "boardImages.h"
+#include "boardProfile.h"
+#include "calibService.h"
+#include "calibration.h"
+#include "cameraParams.h"
+#include "cameraRig.h"
+#include "detectionCache.h"
+#include "detector.h"
+#include "frameRing.h"
+#include "keyframe.h"
+#include "onlineCalib.h"
+#include "pipeline.h"
+#include "poseTracker.h"
+#include "stats.h"
+#include "undistortView.h"
+#include "v4l2Capture.h"
 
 using namespace std;
 using namespace cv;
@@ -24,235 +46,551 @@ namespace {
 		"DICT_4X4_1000=3, DICT_5X5_50=4, DICT_5X5_100=5, DICT_5X5_250=6, DICT_5X5_1000=7, "
 		"DICT_6X6_50=8, DICT_6X6_100=9, DICT_6X6_250=10, DICT_6X6_1000=11, DICT_7X7_50=12,"
 		"DICT_7X7_100=13, DICT_7X7_250=14, DICT_7X7_1000=15, DICT_ARUCO_ORIGINAL = 16}"
-		"{@outfile |<none> | Output file with calibrated camera parameters }"
+		"{pf       |       | Board profile (YAML) with the board, dictionary, detector parameters and calibration flags; other keys override it }"
+		"{@outfile |outFile.txt | Output file with calibrated camera parameters }"
 		"{v        |       | Input from video file, if ommited, input comes from camera }"
+		"{id       |       | Directory (or glob pattern) of input images, processed in batch mode }"
+		"{b        | false | Batch mode: process every frame of the input headlessly and calibrate }"
+		"{j        | 0     | Worker threads for batch mode, 0 uses all cores }"
+		"{ac       | false | Select calibration frames automatically instead of pressing 'c', always on in batch mode }"
+		"{mv       | 60    | Maximum number of automatically selected calibration views }"
+		"{cg       | 0     | Stop capturing once this fraction of the image grid is densely covered, 0 never stops }"
+		"{cn       | 15    | Views the coverage goal needs at least }"
+		"{cd       | 3     | Charuco corners a grid cell needs to count as densely covered }"
+		"{cr       | true  | Keep only the board region of captured views }"
+		"{oc       | false | Calibrate online while capturing and warm-start the final solve }"
+		"{stats    |       | Write per-stage latency statistics (JSON) to this file at exit }"
 		"{ci       | 0     | Camera id if input doesnt come from video (-v) }"
+		"{fs       | 1280x720 | Camera frame size }"
+		"{fps      | 0     | Camera frame rate, 0 keeps the driver default }"
+		"{v4l      | false | Capture the camera straight from V4L2 (Linux) as grey frames, without colour conversion }"
 		"{dp       |       | File of marker detector parameters }"
 		"{rs       | false | Apply refind strategy }"
 		"{zt       | false | Assume zero tangential distortion }"
 		"{a        |       | Fix aspect ratio (fx/fy) to this value }"
 		"{pc       | false | Fix the principal point at the center }"
-		"{sc       | false | Show detected chessboard corners after calibration }";
+		"{ro       | false | Robust calibration: drop views whose reprojection error stands out and re-solve }"
+		"{sc       | false | Show detected chessboard corners after calibration }"
+		"{rb       | 4     | Depth of the capture frame ring buffer }"
+		"{tr       | false | Track the board and search only around its predicted position }"
+		"{tm       | 4     | Minimum markers to keep tracking, fewer falls back to a full-frame search }"
+		"{ds       | 1     | Detect on an image downscaled by this factor, refine corners at full resolution }"
+		"{aw       | false | Narrow the adaptive threshold sweep to the window size matching the markers seen }"
+		"{hl       | false | Headless: no drawing, preview window or key handling, views are selected automatically }"
+		"{ps       | 0.5   | Preview scale }"
+		"{pn       | 1     | Draw the preview every Nth frame }"
+		"{mc       |       | Capture and calibrate a camera rig: comma separated camera ids or video files }"
+		"{sk       | 20    | Largest timestamp spread (ms) of a synchronized rig frame set }"
+		"{bo       |       | Also write the calibration to this binary file, with undistortion maps }"
+		"{uv       | false | After calibrating, show the live input undistorted to check that straight lines stay straight }"
+		"{gb       |       | Generate board images for printing and exit: comma separated WxH-D or WxH-D:square:marker (meters) }"
+		"{dpi      | 300   | Print resolution of generated boards }"
+		"{go       | .     | Output directory of generated boards }"
+		"{pz       | 3     | PNG compression level (0-9) of generated boards }"
+		"{pt       |       | Track the board pose with this calibration (YAML or binary) instead of calibrating }"
+		"{pu       |       | Stream tracked poses as UDP datagrams to host:port }"
+		"{ocl      | false | Use OpenCL (UMat) for grey conversion, downscaling, the preview and the validation view }"
+		"{dc       |       | Detection cache file: frames seen before reuse their detections, -b with no input calibrates from the cache alone }"
+		"{cs       |       | Run as calibration server: solve the jobs capture stations send to this port }"
+		"{cw       | 0     | Worker threads of the calibration server, 0 uses all cores }"
+		"{rc       |       | Calibrate on the server at host:port instead of locally }"
+		"{sn       | station | Name of this capture station in the calibration server's log }";
 }
 
-static bool readDetectorParameters(string filename, Ptr<aruco::DetectorParameters> &params) {
-	FileStorage fs(filename, FileStorage::READ);
-	if(!fs.isOpened())
+// live preview, frames are added for calibration with 'c' (or by selector, when given)
+// until ESC, the end of the input or the coverage goal, and passed on to online when given
+// previewEvery = 0 runs headless, without drawing or a window
+static void captureViews(VideoCapture &cap, V4l2Capture *v4l2, bool fromVideo, int ringDepth, MarkerDetector &detector,
+	const Ptr<aruco::CharucoBoard> &charBoard, bool refineStrategy, KeyframeSelector *selector,
+	OnlineCalibrator *online, double previewScale, int previewEvery, bool previewOpenCL, DetectionCache *cache,
+	const CoverageGoal &goal, CalibrationViews &views) {
+	// video input steps one frame per key press, a camera paces itself
+	int waitTime = fromVideo ? 0 : 1;
+	Size frameSize = v4l2 ? v4l2->frameSize() :
+		Size((int)cap.get(CAP_PROP_FRAME_WIDTH), (int)cap.get(CAP_PROP_FRAME_HEIGHT));
+
+	// capture runs on its own thread so slow detection frames don't stall the camera,
+	// a video file is read at the pace of the preview instead of dropping frames
+	FrameRing ring(ringDepth, frameSize, v4l2 ? CV_8UC1 : CV_8UC3, !fromVideo);
+	atomic< bool > capturing(true);
+	thread captureThread = v4l2 ? thread(captureGreyFrames, ref(*v4l2), ref(ring), cref(capturing)) :
+		thread(captureFrames, ref(cap), ref(ring), cref(capturing));
+
+	if(previewEvery > 0)
+		cout << "Press 'c' to add current frame. 'ESC' to finish and calibrate" << endl;
+
+	// detect, refine, interpolate and render overlap on separate workers
+	DetectionPipeline pipeline(ring, detector, charBoard, refineStrategy, 8);
+	pipeline.setPreview(previewScale, previewEvery, previewOpenCL);
+	pipeline.start();
+
+	// coverage of the views taken so far, shown on the preview
+	CoverageGrid grid(frameSize, 8, 6, goal.denseCorners);
+	FrameJob *job;
+	int frames = 0;
+	Mat onlineCamera, onlineDist;
+	uint64_t loopAllocations = threadAllocationCount(), loopMatAllocations = threadMatAllocationCount();
+	while((job = pipeline.next()) != 0) {
+		frames++;
+		char key = -1;
+		if(job->preview) {
+			double onlineErr;
+			int onlineViews;
+			if(online && online->estimate(onlineCamera, onlineDist, onlineErr, onlineViews)) {
+				ostringstream status;
+				status << "Online: " << onlineViews << " views, rep error " << onlineErr
+					<< ", fx " << onlineCamera.at< double >(0, 0);
+				putText(job->display, status.str(), Point(10, 40), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 0, 255), 2);
+			}
+			grid.draw(job->display);
+			ostringstream coverage;
+			coverage << views.size() << " views, coverage " << cvRound(100 * grid.coverage()) << "%, dense "
+				<< cvRound(100 * grid.denseCoverage()) << "%";
+			putText(job->display, coverage.str(), Point(10, 60), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(0, 0, 255), 2);
+			{
+				ScopedTimer timer(Stats::IMSHOW);
+				imshow("out", job->display);
+			}
+			key = (char)waitKey(waitTime);
+		}
+		if(key == 27) {
+			pipeline.release(job);
+			break;
+		}
+		bool take = false;
+		if(selector) {
+			take = selector->consider(job->charucoCorners, job->charucoIds, job->image.size());
+			if(take)
+				cout << "Frame selected (" << views.size() + 1 << ")";
+		}
+		else if(key == 'c' && (int)job->ids.size() > 0) {
+			take = true;
+			cout << "Frame captured";
+		}
+		if(take) {
+			views.add(job->corners, job->ids, job->charucoCorners, job->charucoIds, job->image);
+			// right away, the view that ends the loop still reaches the online estimate
+			if(online)
+				online->addView(views.initialCharucoCorners.back(), views.initialCharucoIds.back(), views.imgSize);
+			if(cache)
+				cache->add(hashImage(job->image), job->image.size(), job->corners, job->ids,
+					job->charucoCorners, job->charucoIds);
+			grid.add(job->charucoCorners);
+			cout << ", coverage " << 100 * grid.coverage() << "%, dense " << 100 * grid.denseCoverage() << "%" << endl;
+		}
+		if(selector && selector->full()) {
+			cout << "View limit reached" << endl;
+			pipeline.release(job);
+			break;
+		}
+		if(take && goal.met(grid, views.size())) {
+			cout << "Coverage goal reached" << endl;
+			pipeline.release(job);
+			break;
+		}
+		pipeline.release(job);
+	}
+	loopAllocations = threadAllocationCount() - loopAllocations;
+	loopMatAllocations = threadMatAllocationCount() - loopMatAllocations;
+	capturing = false;
+	ring.close();
+	captureThread.join();
+	pipeline.stop();
+	cout << "Frames captured: " << ring.pushed() << ", dropped: " << ring.dropped() << endl;
+	pipeline.report(cout);
+	if(frames > 0)
+		cout << "  capture loop: " << (double)loopAllocations / frames << " allocations and "
+			<< (double)loopMatAllocations / frames << " Mat buffers per frame" << endl;
+}
+
+static void reportViewMemory(const CalibrationViews &views) {
+	size_t fullBytes = (size_t)views.size() * views.imgSize.area() * 3;
+	cout << "Views: " << views.size() << ", stored image memory " << views.imageBytes() / 1024
+		<< " KB (full frames: " << fullBytes / 1024 << " KB)" << endl;
+}
+
+// a video file, or the camera through V4L2 or VideoCapture
+static bool openInput(const string &video, int camId, Size camSize, double camFps, bool useV4l2, VideoCapture &cap,
+	V4l2Capture &v4l2) {
+	if(!video.empty())
+		cap.open(video);
+	else if(useV4l2)
+		return v4l2.open(camId, camSize, camFps);
+	else {
+		cap.open(camId);
+		cap.set(CAP_PROP_FRAME_WIDTH, camSize.width);
+		cap.set(CAP_PROP_FRAME_HEIGHT, camSize.height);
+		if(camFps > 0)
+			cap.set(CAP_PROP_FPS, camFps);
+	}
+	if(!cap.isOpened()) {
+		cerr << "Cannot open " << (video.empty() ? "the camera" : video) << endl;
 		return false;
-	fs["adaptiveThreshWinSizeMin"] >> params->adaptiveThreshWinSizeMin;
-	fs["adaptiveThreshWinSizeMax"] >> params->adaptiveThreshWinSizeMax;
-	fs["adaptiveThreshWinSizeStep"] >> params->adaptiveThreshWinSizeStep;
-	fs["adaptiveThreshConstant"] >> params->adaptiveThreshConstant;
-	fs["minMarkerPerimeterRate"] >> params->minMarkerPerimeterRate;
-	fs["maxMarkerPerimeterRate"] >> params->maxMarkerPerimeterRate;
-	fs["polygonalApproxAccuracyRate"] >> params->polygonalApproxAccuracyRate;
-	fs["minCornerDistanceRate"] >> params->minCornerDistanceRate;
-	fs["minDistanceToBorder"] >> params->minDistanceToBorder;
-	fs["minMarkerDistanceRate"] >> params->minMarkerDistanceRate;
-	fs["cornerRefinementMethod"] >> params->cornerRefinementMethod;
-	fs["cornerRefinementWinSize"] >> params->cornerRefinementWinSize;
-	fs["cornerRefinementMaxIterations"] >> params->cornerRefinementMaxIterations;
-	fs["cornerRefinementMinAccuracy"] >> params->cornerRefinementMinAccuracy;
-	fs["markerBorderBits"] >> params->markerBorderBits;
-	fs["perspectiveRemovePixelPerCell"] >> params->perspectiveRemovePixelPerCell;
-	fs["perspectiveRemoveIgnoredMarginPerCell"] >> params->perspectiveRemoveIgnoredMarginPerCell;
-	fs["maxErroneousBitsInBorderRate"] >> params->maxErroneousBitsInBorderRate;
-	fs["minOtsuStdDev"] >> params->minOtsuStdDev;
-	fs["errorCorrectionRate"] >> params->errorCorrectionRate;
+	}
 	return true;
 }
 
-static bool saveCameraParams(const string &filename, Size imageSize, float aspectRatio, int flags,
-	const Mat &cameraMatrix, const Mat &distCoeffs, double totalAvgErr) {
+// name.ext -> name<suffix>.ext
+static string withSuffix(const string &filename, const string &suffix) {
+	size_t dot = filename.find_last_of('.');
+	size_t slash = filename.find_last_of("/\\");
+	if(dot == string::npos || (slash != string::npos && dot < slash))
+		return filename + suffix;
+	return filename.substr(0, dot) + suffix + filename.substr(dot);
+}
+
+// captures all cameras of a rig together, calibrates each one and every pair of them; the
+// intrinsics go to outputFile (and binaryFile) with a _cam<i> suffix, the pair poses to a _extrinsics file
+static void calibrateRig(const vector< string > &sources, const MarkerDetector &detector,
+	const Ptr<aruco::CharucoBoard> &charBoard, const RigOptions &options, bool autoSelect, int maxViews,
+	bool cropViews, int calibrationFlags, double aspectRatio, bool robust, const string &outputFile,
+	const string &binaryFile) {
+	CameraRig rig;
+	if(!rig.open(sources, options.frameSize, options.fps))
+		return;
+	int n = rig.size();
+	vector< CalibrationViews > views(n);
+	for(int i = 0; i < n; i++) {
+		views[i].crop = cropViews;
+		if(autoSelect)
+			views[i].reserve(maxViews, (int)charBoard->ids.size());
+	}
+	vector< KeyframeSelector > selectors(n, KeyframeSelector(charBoard, maxViews));
+	vector< PairViews > pairs;
+	rig.capture(detector, charBoard, options, autoSelect ? &selectors : 0, views, pairs);
+
+	vector< CalibrationResult > calib(n);
+	for(int i = 0; i < n; i++) {
+		cout << "Camera " << i << ":" << endl;
+		reportViewMemory(views[i]);
+		if(!calibrateCharuco(views[i], charBoard, calibrationFlags, aspectRatio, calib[i]))
+			return;
+		if(robust)
+			rejectOutlierViews(charBoard, views[i].imgSize, calibrationFlags, calib[i]);
+		views[i].releaseImages();
+		ostringstream suffix;
+		suffix << "_cam" << i;
+		string filename = withSuffix(outputFile, suffix.str());
+		if(!saveCameraParams(filename, views[i].imgSize, (float)aspectRatio, calibrationFlags,
+			calib[i].cameraMatrix, calib[i].distCoeffs, calib[i].repError)) {
+			cerr << "Cannot save output file " << filename << endl;
+			return;
+		}
+		if(!binaryFile.empty()) {
+			string binaryName = withSuffix(binaryFile, suffix.str());
+			if(!saveCameraParamsBinary(binaryName, views[i].imgSize, (float)aspectRatio, calibrationFlags,
+				calib[i].cameraMatrix, calib[i].distCoeffs, calib[i].repError)) {
+				cerr << "Cannot save binary output file " << binaryName << endl;
+				return;
+			}
+		}
+		cout << "Rep Error: " << calib[i].repError << ", saved to " << filename << endl;
+	}
+
+	string filename = withSuffix(outputFile, "_extrinsics");
 	FileStorage fs(filename, FileStorage::WRITE);
-	if(!fs.isOpened())
-		return false;
-	time_t tt;
-	time(&tt);
-	struct tm *t2 = localtime(&tt);
-	char buf[1024];
-	strftime(buf, sizeof(buf) - 1, "%c", t2);
-	fs << "calibration_time" << buf;
-	fs << "image_width" << imageSize.width;
-	fs << "image_height" << imageSize.height;
-	if(flags & CALIB_FIX_ASPECT_RATIO) fs << "aspectRatio" << aspectRatio;
-	if(flags != 0) {
-		sprintf(buf, "flags: %s%s%s%s",
-			flags & CALIB_USE_INTRINSIC_GUESS ? "+use_intrinsic_guess" : "",
-			flags & CALIB_FIX_ASPECT_RATIO ? "+fix_aspectRatio" : "",
-			flags & CALIB_FIX_PRINCIPAL_POINT ? "+fix_principal_point" : "",
-			flags & CALIB_ZERO_TANGENT_DIST ? "+zero_tangent_dist" : "");
+	if(!fs.isOpened()) {
+		cerr << "Cannot save output file " << filename << endl;
+		return;
 	}
-	fs << "flags" << flags;
-	fs << "camera_matrix" << cameraMatrix;
-	fs << "distortion_coefficients" << distCoeffs;
-	fs << "avg_reprojection_error" << totalAvgErr;
-	return true;
+	for(size_t p = 0; p < pairs.size(); p++) {
+		const PairViews &pair = pairs[p];
+		StereoResult stereo;
+		if(!calibratePair(pair, calib[pair.first], calib[pair.second], views[pair.first].imgSize, stereo))
+			continue;
+		ostringstream name;
+		name << "pair_" << pair.first << "_" << pair.second;
+		fs << name.str() << "{";
+		fs << "first_camera" << pair.first << "second_camera" << pair.second << "views" << pair.size();
+		fs << "R" << stereo.R << "T" << stereo.T << "E" << stereo.E << "F" << stereo.F;
+		fs << "avg_reprojection_error" << stereo.repError;
+		fs << "}";
+		cout << "Cameras " << pair.first << "-" << pair.second << ": stereo rep error " << stereo.repError
+			<< " over " << pair.size() << " views, baseline " << norm(stereo.T) << endl;
+	}
+	cout << "Extrinsics saved to " << filename << endl;
 }
 
-Mat charImg, Img;
+// writes the statistics on every way out of main
+struct StatsReport {
+	~StatsReport() {
+		cout << stats().summary();
+		if(!filename.empty() && !stats().writeJson(filename))
+			cerr << "Cannot write statistics to " << filename << endl;
+	}
+	string filename;
+};
+
+int main(int argc, char *argv[]) {
+	countMatAllocations();
+	CommandLineParser parser(argc, argv, keys);
+	parser.about(about);
+	string outputFile = parser.get<string>("@outfile");
+	string video = parser.get<string>("v");
+	string imageDir = parser.get<string>("id");
+	int camId = parser.get<int>("ci");
+	Size camSize;
+	if(sscanf(parser.get<string>("fs").c_str(), "%dx%d", &camSize.width, &camSize.height) != 2) {
+		cerr << "Frame size must be WxH" << endl;
+		return 0;
+	}
+	double camFps = parser.get<double>("fps");
+	bool useV4l2 = parser.get<bool>("v4l");
+	bool batch = parser.get<bool>("b") || !imageDir.empty();
+	int threads = parser.get<int>("j");
+	int ringDepth = parser.get<int>("rb");
+	bool trackBoard = parser.get<bool>("tr");
+	int trackMinMarkers = parser.get<int>("tm");
+	double downscale = parser.get<double>("ds");
+	bool adaptiveWindow = parser.get<bool>("aw");
+	bool robust = parser.get<bool>("ro");
+	bool autoSelect = parser.get<bool>("ac") || batch || parser.get<bool>("hl");
+	int maxViews = parser.get<int>("mv");
+	CoverageGoal goal;
+	goal.coverage = parser.get<double>("cg");
+	goal.minViews = parser.get<int>("cn");
+	goal.denseCorners = parser.get<int>("cd");
+	bool cropViews = parser.get<bool>("cr");
+	bool onlineCalibration = parser.get<bool>("oc") && !batch;
+	string statsFile = parser.get<string>("stats");
+	bool headless = parser.get<bool>("hl");
+	double previewScale = parser.get<double>("ps");
+	int previewEvery = parser.get<int>("pn");
+	vector< string > rigSources = splitSources(parser.get<string>("mc"));
+	double maxSkew = parser.get<double>("sk");
+	string cacheFile = parser.get<string>("dc");
+	string binaryFile = parser.get<string>("bo");
+	bool validate = parser.get<bool>("uv");
+	bool useOpenCL = parser.get<bool>("ocl");
+	string calibrationServer = parser.get<string>("rc");
+	if(!parser.check()) {
+		parser.printErrors();
+		return 0;
+	}
+	if(parser.has("gb")) {
+		float squareLength = parser.has("sl") ? parser.get<float>("sl") : 0.04f;
+		float markerLength = parser.has("ml") ? parser.get<float>("ml") : 0.02f;
+		vector< BoardSpec > specs;
+		if(!parseBoardSpecs(parser.get<string>("gb"), squareLength, markerLength, specs))
+			return 0;
+		generateBoards(specs, parser.get<string>("go"), parser.get<double>("dpi"),
+			min(max(parser.get<int>("pz"), 0), 9));
+		return 0;
+	}
+	if(parser.has("cs")) {
+		// the board arrives with every job
+		runCalibrationServer(parser.get<string>("cs"), parser.get<int>("cw"));
+		return 0;
+	}
+	if(batch && video.empty() && imageDir.empty() && cacheFile.empty()) {
+		cerr << "Batch mode needs a video (-v), image directory (-id) or detection cache (-dc)" << endl;
+		return 0;
+	}
+	StatsReport statsReport;
+	statsReport.filename = statsFile;
 
-int main() {
-	int squaresX = 5;
-	int squaresY = 7;
-	float squareLength = 0.04;
-	float markerLength = 0.02;
-	string outputFile = "outFile.txt";
-	bool showChessboardCorners = true;
+	// built-in defaults, then the profile, then the command line
+	BoardProfile profile;
+	if(parser.has("pf") && !readBoardProfile(parser.get<string>("pf"), profile))
+		return 0;
+	if(parser.has("w"))
+		profile.squaresX = parser.get<int>("w");
+	if(parser.has("h"))
+		profile.squaresY = parser.get<int>("h");
+	if(parser.has("sl"))
+		profile.squareLength = parser.get<float>("sl");
+	if(parser.has("ml"))
+		profile.markerLength = parser.get<float>("ml");
+	if(parser.has("d"))
+		profile.dictionary = parser.get<int>("d");
+	if(parser.has("dp"))
+		profile.detectorParams = parser.get<string>("dp");
+	if(parser.has("a"))
+		profile.aspectRatio = parser.get<double>("a");
+	profile.refineStrategy = profile.refineStrategy || parser.get<bool>("rs");
+	profile.zeroTangentDist = profile.zeroTangentDist || parser.get<bool>("zt");
+	profile.fixPrincipalPoint = profile.fixPrincipalPoint || parser.get<bool>("pc");
+	// the command line may have broken what the profile file had right
+	if(!profile.valid()) {
+		cerr << "Invalid board: " << profile.squaresX << "x" << profile.squaresY << " squares of " << profile.squareLength
+			<< " with markers of " << profile.markerLength << ", dictionary " << profile.dictionary
+			<< ", aspect ratio " << profile.aspectRatio << " (or the dictionary holds too few markers)" << endl;
+		return 0;
+	}
+	// a remote solve returns no interpolated corners to show
+	bool showChessboardCorners = parser.get<bool>("sc") && !batch && !headless && calibrationServer.empty();
 
-	int calibrationFlags = 0;
-	calibrationFlags |= CALIB_FIX_ASPECT_RATIO;
-	double aspectRatio = (16 / 9);
-	//calibrationFlags |= CALIB_ZERO_TANGENT_DIST;
-	//calibrationFlags |= CALIB_FIX_PRINCIPAL_POINT;
+	int calibrationFlags = profile.calibrationFlags();
+	double aspectRatio = profile.aspectRatio;
 
 	Ptr<aruco::DetectorParameters> detect = aruco::DetectorParameters::create();
-	if(!readDetectorParameters("detectIn.yml", detect)) {cerr << "Err DetectIn"; return 0;}
-	bool refineStrategy = false;
-
-	VideoCapture cap = VideoCapture(0);
-	cap.set(CAP_PROP_FRAME_WIDTH, 1280);
-	cap.set(CAP_PROP_FRAME_HEIGHT, 720);
-	int waitTime = 20;
+	if(!readDetectorParameters(profile.detectorParams, detect)) {
+		cerr << "Invalid detector parameters file " << profile.detectorParams << endl;
+		return 0;
+	}
+	bool refineStrategy = profile.refineStrategy;
 
 	Ptr<aruco::Dictionary> dictionary =
-		getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(10));
+		getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(profile.dictionary));
 
 	// create charuco board object
-	Ptr<aruco::CharucoBoard> charBoard = aruco::CharucoBoard::create(squaresX, squaresY, squareLength, markerLength, dictionary);
-	charBoard->draw(Size(700, 900), charImg, 50, 1);
-	imwrite("charImg.png", charImg);
-	Ptr<aruco::Board> board = charBoard.staticCast<aruco::Board>();
-
-	// collect data from each frame
-	vector< vector< vector< Point2f > > > allCorners;
-	vector< vector< int > > allIds;
-	vector< Mat > allImgs;
-	Size imgSize;
-
-	while(cap.grab()) {
-		Mat image, imageCopy;
-		cap.retrieve(image);
-
-		vector< int > ids;
-		vector< vector< Point2f > > corners, rejected;
-
-		// detect markers
-		detectMarkers(image, dictionary, corners, ids, detect, rejected);
-
-		// refind strategy to detect more markers
-		if(refineStrategy) refineDetectedMarkers(image, board, corners, ids, rejected);
-
-		// interpolate charuco corners
-		Mat currentCharucoCorners, currentCharucoIds;
-		if((int)ids.size() > 0)
-			interpolateCornersCharuco(corners, ids, image, charBoard, currentCharucoCorners,
-				currentCharucoIds);
-
-		// draw results
-		image.copyTo(imageCopy);
-		if((int)ids.size() > 0) aruco::drawDetectedMarkers(imageCopy, corners);
-
-		if(currentCharucoCorners.total() > 0)
-			aruco::drawDetectedCornersCharuco(imageCopy, currentCharucoCorners, currentCharucoIds);
-
-		putText(imageCopy, "Press 'c' to add current frame. 'ESC' to finish and calibrate",
-			Point(10, 20), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 0, 0), 2);
-
-		imshow("out", imageCopy);
-		char key = (char)waitKey(waitTime);
-		if(key == 27) break;
-		if(key == 'c' && (int)ids.size() > 0) {
-			cout << "Frame captured" << endl;
-			allCorners.push_back(corners);
-			allIds.push_back(ids);
-			allImgs.push_back(image);
-			imgSize = image.size();
-			cout << imgSize << "\n";
-		}
+	Ptr<aruco::CharucoBoard> charBoard = aruco::CharucoBoard::create(profile.squaresX, profile.squaresY,
+		profile.squareLength, profile.markerLength, dictionary);
+
+	MarkerDetector detector(dictionary, detect);
+	detector.setDownscale(downscale);
+	detector.setAdaptiveWindow(adaptiveWindow);
+	detector.setBoardIds(charBoard->ids);
+	bool detectOnDevice = useOpenCL && detector.setOpenCL(true);
+	if(useOpenCL && !detectOnDevice)
+		cerr << "No OpenCL device, detection stays on the CPU" << endl;
+
+	// detections only depend on the detector settings, so a cache serves any calibration flags;
+	// batch workers never track, a batch run over the cache alone keeps -tr to match a capture's records
+	bool batchDetects = batch && (!video.empty() || !imageDir.empty());
+	int cacheTracking = trackBoard && !batchDetects ? max(trackMinMarkers, 1) : 0;
+	DetectionCache cache;
+	if(!cacheFile.empty() && !cache.open(cacheFile, detectionKey(detect, charBoard, downscale, refineStrategy,
+		adaptiveWindow, cacheTracking, detectOnDevice)))
+		return 0;
+	DetectionCache *detectionCache = cache.isOpen() ? &cache : 0;
+
+	if(parser.has("pt")) {
+		CameraParams camera;
+		if(!loadCameraParams(parser.get<string>("pt"), camera))
+			return 0;
+		VideoCapture cap;
+		V4l2Capture v4l2;
+		if(!openInput(video, camId, camSize, camFps, useV4l2, cap, v4l2))
+			return 0;
+		detector.setTracking(trackBoard, trackMinMarkers);
+		PoseOptions options;
+		options.ringDepth = ringDepth;
+		options.fromVideo = !video.empty();
+		options.previewScale = previewScale;
+		options.previewEvery = headless ? 0 : max(previewEvery, 1);
+		options.streamTarget = parser.get<string>("pu");
+		trackPoses(cap, v4l2.isOpened() ? &v4l2 : 0, detector, charBoard, camera, options);
+		return 0;
 	}
 
-	if((int)allIds.size() < 1) {
-		cerr << "Not enough captures for calibration" << endl;
+	if(!rigSources.empty()) {
+		// every camera's pipeline works on a copy of the detector
+		detector.setTracking(trackBoard, trackMinMarkers);
+		RigOptions options;
+		options.frameSize = camSize;
+		options.fps = camFps;
+		options.ringDepth = ringDepth;
+		options.refineStrategy = refineStrategy;
+		options.maxSkewMs = maxSkew;
+		options.previewScale = previewScale;
+		options.previewEvery = headless ? 0 : max(previewEvery, 1);
+		options.openCL = useOpenCL;
+		calibrateRig(rigSources, detector, charBoard, options, autoSelect, maxViews, cropViews,
+			calibrationFlags, aspectRatio, robust, outputFile, binaryFile);
 		return 0;
 	}
 
-	Mat cameraMatrix, distCoeffs;
-	vector< Mat > rvecs, tvecs;
-
-	if(calibrationFlags & CALIB_FIX_ASPECT_RATIO) {
-		cameraMatrix = Mat::eye(3, 3, CV_64F);
-		cameraMatrix.at< double >(0, 0) = aspectRatio;
+	// collect data from each frame
+	CalibrationViews views;
+	views.crop = cropViews;
+	if(autoSelect)
+		views.reserve(maxViews, (int)charBoard->ids.size());
+	KeyframeSelector selector(charBoard, maxViews);
+	KeyframeSelector *autoSelector = autoSelect ? &selector : 0;
+	OnlineCalibrator online(charBoard, calibrationFlags, aspectRatio);
+	VideoCapture cap;
+	V4l2Capture v4l2;
+	if(batch && video.empty() && imageDir.empty())
+		collectCachedViews(cache, autoSelector, views);
+	else if(batch) {
+		// frames are spread over workers, so there is no previous frame to track from
+		if(!collectBatchViews(video, imageDir, detector, charBoard, refineStrategy, threads, autoSelector,
+			detectionCache, views))
+			return 0;
 	}
-
-	// prepare data for calibration
-	vector< vector< Point2f > > allCornersConcatenated;
-	vector< int > allIdsConcatenated;
-	vector< int > markerCounterPerFrame;
-	markerCounterPerFrame.reserve(allCorners.size());
-	for(unsigned int i = 0; i < allCorners.size(); i++) {
-		markerCounterPerFrame.push_back((int)allCorners[i].size());
-		for(unsigned int j = 0; j < allCorners[i].size(); j++) {
-			allCornersConcatenated.push_back(allCorners[i][j]);
-			allIdsConcatenated.push_back(allIds[i][j]);
-		}
+	else {
+		if(!openInput(video, camId, camSize, camFps, useV4l2, cap, v4l2))
+			return 0;
+		detector.setTracking(trackBoard, trackMinMarkers);
+		if(onlineCalibration)
+			online.start();
+		captureViews(cap, v4l2.isOpened() ? &v4l2 : 0, !video.empty(), ringDepth, detector, charBoard, refineStrategy, autoSelector,
+			onlineCalibration ? &online : 0, previewScale, headless ? 0 : max(previewEvery, 1), useOpenCL,
+			detectionCache, goal, views);
+		online.stop();
 	}
 
-	// calibrate camera using aruco markers
-	double arucoRepErr = calibrateCameraAruco(allCornersConcatenated, allIdsConcatenated,
-		markerCounterPerFrame, board, imgSize, cameraMatrix,
-		distCoeffs, noArray(), noArray(), calibrationFlags);
-
-	// prepare data for charuco calibration
-	int nFrames = (int)allCorners.size();
-	vector< Mat > allCharucoCorners;
-	vector< Mat > allCharucoIds;
-	vector< Mat > filteredImages;
-	allCharucoCorners.reserve(nFrames);
-	allCharucoIds.reserve(nFrames);
-
-	for(int i = 0; i < nFrames; i++) {
-		// interpolate using camera parameters
-		Mat currentCharucoCorners, currentCharucoIds;
-		interpolateCornersCharuco(allCorners[i], allIds[i], allImgs[i], charBoard,
-			currentCharucoCorners, currentCharucoIds, cameraMatrix,
-			distCoeffs);
-
-		allCharucoCorners.push_back(currentCharucoCorners);
-		allCharucoIds.push_back(currentCharucoIds);
-		filteredImages.push_back(allImgs[i]);
+	reportViewMemory(views);
+
+	CalibrationResult calib;
+	double onlineErr;
+	int onlineViews;
+	bool warmStart = onlineCalibration &&
+		online.estimate(calib.cameraMatrix, calib.distCoeffs, onlineErr, onlineViews);
+	if(warmStart)
+		cout << "Starting from the online estimate over " << onlineViews << " views (rep error " << onlineErr << ")" << endl;
+	if(!calibrationServer.empty()) {
+		CalibrationRequest request;
+		request.profile = profile;
+		request.robust = robust;
+		request.station = parser.get<string>("sn");
+		string yaml;
+		if(!submitCalibration(calibrationServer, request, views, yaml, calib.repError))
+			return 0;
+		ofstream out(outputFile.c_str(), ios::binary);
+		out << yaml;
+		// read the result back for the binary output and the validation view
+		CameraParams camera;
+		if(!out.flush() || !loadCameraParams(outputFile, camera)) {
+			cerr << "Cannot save output file" << endl;
+			return 0;
+		}
+		calib.cameraMatrix = camera.cameraMatrix;
+		calib.distCoeffs = camera.distCoeffs;
+		calib.arucoRepErr = -1;
+		views.releaseImages();
 	}
-
-	if(allCharucoCorners.size() < 4) {
-		cerr << "Not enough corners for calibration" << endl;
-		return 0;
+	else {
+		if(!calibrateCharuco(views, charBoard, calibrationFlags, aspectRatio, calib, warmStart))
+			return 0;
+		if(robust)
+			rejectOutlierViews(charBoard, views.imgSize, calibrationFlags, calib);
+		if(!showChessboardCorners)
+			views.releaseImages();
+
+		bool saveOk = saveCameraParams(outputFile, views.imgSize, (float)aspectRatio, calibrationFlags,
+			calib.cameraMatrix, calib.distCoeffs, calib.repError);
+		if(!saveOk) {
+			cerr << "Cannot save output file" << endl;
+			return 0;
+		}
 	}
-
-	// calibrate camera using charuco
-	double repError =
-		calibrateCameraCharuco(allCharucoCorners, allCharucoIds, charBoard, imgSize,
-			cameraMatrix, distCoeffs, rvecs, tvecs, calibrationFlags);
-
-	bool saveOk = saveCameraParams(outputFile, imgSize, (float)aspectRatio, calibrationFlags,
-		cameraMatrix, distCoeffs, repError);
-	if(!saveOk) {
-		cerr << "Cannot save output file" << endl;
+	if(!binaryFile.empty() && !saveCameraParamsBinary(binaryFile, views.imgSize, (float)aspectRatio,
+		calibrationFlags, calib.cameraMatrix, calib.distCoeffs, calib.repError)) {
+		cerr << "Cannot save binary output file" << endl;
 		return 0;
 	}
 
-	cout << "Rep Error: " << repError << endl;
-	cout << "Rep Error Aruco: " << arucoRepErr << endl;
+	cout << "Rep Error: " << calib.repError << endl;
+	if(calib.arucoRepErr >= 0)
+		cout << "Rep Error Aruco: " << calib.arucoRepErr << endl;
 	cout << "Calibration saved to " << outputFile << endl;
 
 	// show interpolated charuco corners for debugging
 	if(showChessboardCorners) {
-		for(unsigned int frame = 0; frame < filteredImages.size(); frame++) {
-			Mat imageCopy = filteredImages[frame].clone();
-			if((int)allIds[frame].size() > 0) {
-
-				if(allCharucoCorners[frame].total() > 0) {
-					aruco::drawDetectedCornersCharuco(imageCopy, allCharucoCorners[frame],
-						allCharucoIds[frame]);
+		int waitTime = 20;
+		Mat imageCopy, localCorners;
+		for(int frame = 0; frame < views.size(); frame++) {
+			// stored views are grey and may be cropped
+			cvtColor(views.allImgs[frame], imageCopy, COLOR_GRAY2BGR);
+			if(views.markers.markers(frame) > 0) {
+
+				if(calib.allCharucoCorners[frame].total() > 0) {
+					Point offset = views.allOffsets[frame];
+					subtract(calib.allCharucoCorners[frame], Scalar(offset.x, offset.y), localCorners);
+					aruco::drawDetectedCornersCharuco(imageCopy, localCorners,
+						calib.allCharucoIds[frame]);
 				}
 			}
 
@@ -262,5 +600,19 @@ int main() {
 		}
 	}
 
+	if(validate && !batch && !headless) {
+		// a video was read to its end by the capture, start it over
+		if(!video.empty())
+			cap.open(video);
+		else if(v4l2.isOpened()) {
+			// the validation view shows colour, so it goes through VideoCapture
+			v4l2.close();
+			cap.open(camId);
+			cap.set(CAP_PROP_FRAME_WIDTH, camSize.width);
+			cap.set(CAP_PROP_FRAME_HEIGHT, camSize.height);
+		}
+		showUndistorted(cap, !video.empty(), ringDepth, calib.cameraMatrix, calib.distCoeffs, previewScale, useOpenCL);
+	}
+
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,266 @@
+#include "detectionCache.h"
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const char magic[8] = { 'C', 'H', 'A', 'R', 'C', 'A', 'C', 'H' };
+	const uint32_t version = 1;
+
+	struct FileHeader {
+		char magic[8];
+		uint32_t version, reserved;
+	};
+
+	struct RecordHeader {
+		uint64_t imageKey, paramsKey;
+		int32_t width, height;
+		int32_t markers, charucoCount;
+	};
+
+	// record payload: markers * 4 corners, markers ids, charucoCount corners and ids
+	size_t payloadSize(const RecordHeader &h) {
+		size_t bytes = (size_t)h.markers * (4 * sizeof(Point2f) + sizeof(int32_t)) +
+			(size_t)h.charucoCount * (sizeof(Point2f) + sizeof(int32_t));
+		return (bytes + 7) & ~(size_t)7;
+	}
+
+	template< typename T > uint64_t hashValue(const T &value, uint64_t seed) {
+		return hashBytes(&value, sizeof(value), seed);
+	}
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t h = seed;
+	for(size_t i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+uint64_t hashImage(const Mat &image) {
+	uint64_t h = hashValue(image.rows, hashValue(image.cols, hashValue(image.type(), hashBytes(0, 0))));
+	size_t rowBytes = image.cols * image.elemSize();
+	for(int y = 0; y < image.rows; y++)
+		h = hashBytes(image.ptr(y), rowBytes, h);
+	return h;
+}
+
+uint64_t hashFile(const string &filename) {
+	FILE *f = fopen(filename.c_str(), "rb");
+	if(!f)
+		return 0;
+	uint64_t h = hashBytes(0, 0);
+	vector< char > buffer(1 << 16);
+	size_t n;
+	while((n = fread(buffer.data(), 1, buffer.size(), f)) > 0)
+		h = hashBytes(buffer.data(), n, h);
+	fclose(f);
+	return h;
+}
+
+uint64_t detectionKey(const Ptr< aruco::DetectorParameters > &params, const Ptr< aruco::CharucoBoard > &charBoard,
+	double downscale, bool refineStrategy, bool adaptiveWindow, int trackMinMarkers, bool openCL) {
+	const aruco::DetectorParameters &p = *params;
+	uint64_t h = hashBytes(0, 0);
+	h = hashValue(p.adaptiveThreshWinSizeMin, h);
+	h = hashValue(p.adaptiveThreshWinSizeMax, h);
+	h = hashValue(p.adaptiveThreshWinSizeStep, h);
+	h = hashValue(p.adaptiveThreshConstant, h);
+	h = hashValue(p.minMarkerPerimeterRate, h);
+	h = hashValue(p.maxMarkerPerimeterRate, h);
+	h = hashValue(p.polygonalApproxAccuracyRate, h);
+	h = hashValue(p.minCornerDistanceRate, h);
+	h = hashValue(p.minDistanceToBorder, h);
+	h = hashValue(p.minMarkerDistanceRate, h);
+	h = hashValue(p.cornerRefinementMethod, h);
+	h = hashValue(p.cornerRefinementWinSize, h);
+	h = hashValue(p.cornerRefinementMaxIterations, h);
+	h = hashValue(p.cornerRefinementMinAccuracy, h);
+	h = hashValue(p.markerBorderBits, h);
+	h = hashValue(p.perspectiveRemovePixelPerCell, h);
+	h = hashValue(p.perspectiveRemoveIgnoredMarginPerCell, h);
+	h = hashValue(p.maxErroneousBitsInBorderRate, h);
+	h = hashValue(p.minOtsuStdDev, h);
+	h = hashValue(p.errorCorrectionRate, h);
+
+	Size squares = charBoard->getChessboardSize();
+	h = hashValue(squares.width, hashValue(squares.height, h));
+	h = hashValue(charBoard->getSquareLength(), hashValue(charBoard->getMarkerLength(), h));
+	h = hashValue(hashImage(charBoard->dictionary->bytesList), h);
+	h = hashValue(downscale, hashValue(refineStrategy, h));
+	h = hashValue(adaptiveWindow, hashValue(trackMinMarkers, hashValue(openCL, h)));
+	return h;
+}
+
+DetectionCache::~DetectionCache() {
+	if(file)
+		fclose(file);
+}
+
+bool DetectionCache::open(const string &filename, uint64_t key) {
+	paramsKey = key;
+	vector< char > data;
+	FILE *in = fopen(filename.c_str(), "rb");
+	if(in) {
+		fseek(in, 0, SEEK_END);
+		long size = ftell(in);
+		fseek(in, 0, SEEK_SET);
+		data.resize(size > 0 ? size : 0);
+		if(!data.empty() && fread(data.data(), 1, data.size(), in) != data.size())
+			data.clear();
+		fclose(in);
+	}
+
+	size_t valid = 0;
+	if(!data.empty()) {
+		FileHeader header;
+		if(data.size() < sizeof(header) || (memcpy(&header, data.data(), sizeof(header)),
+			memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)) {
+			cerr << filename << " is not a detection cache of this version" << endl;
+			return false;
+		}
+		size_t pos = sizeof(header);
+		int skipped = 0;
+		while(pos + sizeof(RecordHeader) <= data.size()) {
+			RecordHeader h;
+			memcpy(&h, &data[pos], sizeof(h));
+			if(h.markers < 0 || h.charucoCount < 0 || pos + sizeof(h) + payloadSize(h) > data.size())
+				break;
+			const char *payload = &data[pos + sizeof(h)];
+			if(h.paramsKey == paramsKey) {
+				const Point2f *corners = (const Point2f *)payload;
+				const int *ids = (const int *)(corners + 4 * h.markers);
+				const Point2f *charuco = (const Point2f *)(ids + h.markers);
+				const int *charucoId = (const int *)(charuco + h.charucoCount);
+				store(h.imageKey, Size(h.width, h.height), corners, ids, h.markers, charuco, charucoId, h.charucoCount);
+			}
+			else
+				skipped++;
+			pos += sizeof(h) + payloadSize(h);
+		}
+		valid = pos;
+		if(skipped > 0)
+			cout << "Detection cache: " << skipped << " entries made with other detection settings ignored" << endl;
+	}
+
+	if(valid > 0 && valid < data.size()) {
+		// an interrupted write left a partial record, keep only the complete ones
+		cerr << "Detection cache: dropping a damaged tail of " << data.size() - valid << " bytes" << endl;
+		file = fopen(filename.c_str(), "wb");
+		if(file)
+			fwrite(data.data(), 1, valid, file);
+	}
+	else
+		file = fopen(filename.c_str(), "ab");
+	if(!file) {
+		cerr << "Cannot open detection cache " << filename << endl;
+		return false;
+	}
+	if(valid == 0) {
+		FileHeader header;
+		memcpy(header.magic, magic, sizeof(magic));
+		header.version = version;
+		header.reserved = 0;
+		fwrite(&header, sizeof(header), 1, file);
+		fflush(file);
+	}
+	cout << "Detection cache: " << size() << " entries loaded from " << filename << endl;
+	return true;
+}
+
+void DetectionCache::store(uint64_t imageKey, Size imageSize, const Point2f *corners, const int *ids, int count,
+	const Point2f *charuco, const int *charucoId, int charucoCount) {
+	markers.add(corners, ids, count);
+	charucoOffsets.push_back((int)charucoIds.size());
+	charucoCorners.insert(charucoCorners.end(), charuco, charuco + charucoCount);
+	charucoIds.insert(charucoIds.end(), charucoId, charucoId + charucoCount);
+	imageSizes.push_back(imageSize);
+	index[imageKey] = markers.size() - 1;
+}
+
+bool DetectionCache::contains(uint64_t imageKey) const {
+	lock_guard< mutex > lock(mtx);
+	return index.count(imageKey) > 0;
+}
+
+bool DetectionCache::find(uint64_t imageKey, Entry &entry) {
+	lock_guard< mutex > lock(mtx);
+	unordered_map< uint64_t, int >::const_iterator it = index.find(imageKey);
+	if(it == index.end())
+		return false;
+	read(it->second, entry);
+	nHits++;
+	return true;
+}
+
+void DetectionCache::add(uint64_t imageKey, Size imageSize, const vector< vector< Point2f > > &corners,
+	const vector< int > &ids, const Mat &charucoCornersIn, const Mat &charucoIdsIn) {
+	RecordHeader h;
+	h.imageKey = imageKey;
+	h.paramsKey = paramsKey;
+	h.width = imageSize.width;
+	h.height = imageSize.height;
+	h.markers = (int32_t)ids.size();
+	h.charucoCount = (int32_t)charucoIdsIn.total();
+
+	// one contiguous record so a single fwrite appends it
+	vector< char > record(sizeof(h) + payloadSize(h), 0);
+	memcpy(record.data(), &h, sizeof(h));
+	Point2f *outCorners = (Point2f *)&record[sizeof(h)];
+	for(size_t m = 0; m < corners.size(); m++)
+		memcpy(outCorners + 4 * m, corners[m].data(), 4 * sizeof(Point2f));
+	int *outIds = (int *)(outCorners + 4 * h.markers);
+	if(h.markers > 0)
+		memcpy(outIds, ids.data(), h.markers * sizeof(int));
+	Point2f *outCharuco = (Point2f *)(outIds + h.markers);
+	int *outCharucoIds = (int *)(outCharuco + h.charucoCount);
+	for(int c = 0; c < h.charucoCount; c++) {
+		outCharuco[c] = charucoCornersIn.at< Point2f >(c);
+		outCharucoIds[c] = charucoIdsIn.at< int >(c);
+	}
+
+	lock_guard< mutex > lock(mtx);
+	if(index.count(imageKey))
+		return;
+	store(imageKey, imageSize, outCorners, outIds, h.markers, outCharuco, outCharucoIds, h.charucoCount);
+	nAdded++;
+	if(file) {
+		fwrite(record.data(), 1, record.size(), file);
+		fflush(file);
+	}
+}
+
+int DetectionCache::size() const {
+	lock_guard< mutex > lock(mtx);
+	return markers.size();
+}
+
+void DetectionCache::entry(int i, Entry &entry) const {
+	lock_guard< mutex > lock(mtx);
+	read(i, entry);
+}
+
+void DetectionCache::read(int i, Entry &entry) const {
+	entry.imageSize = imageSizes[i];
+	int count = markers.markers(i);
+	const Point2f *corners = markers.viewCorners(i);
+	entry.corners.resize(count);
+	for(int m = 0; m < count; m++)
+		entry.corners[m].assign(corners + 4 * m, corners + 4 * m + 4);
+	entry.ids.assign(markers.viewIds(i), markers.viewIds(i) + count);
+	int begin = charucoOffsets[i];
+	int end = i + 1 < (int)charucoOffsets.size() ? charucoOffsets[i + 1] : (int)charucoIds.size();
+	if(end > begin) {
+		Mat(end - begin, 1, CV_32FC2, (void *)&charucoCorners[begin]).copyTo(entry.charucoCorners);
+		Mat(end - begin, 1, CV_32S, (void *)&charucoIds[begin]).copyTo(entry.charucoIds);
+	}
+	else {
+		entry.charucoCorners.release();
+		entry.charucoIds.release();
+	}
+}
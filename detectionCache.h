@@ -0,0 +1,73 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "viewStore.h"
+
+// FNV-1a over raw bytes, seed chains several calls
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL);
+// pixels and geometry of an image
+uint64_t hashImage(const cv::Mat &image);
+// contents of a file, 0 when it cannot be read
+uint64_t hashFile(const std::string &filename);
+// everything detection and the initial interpolation depend on: the detector
+// parameters, the board and its dictionary, downscaling, the refind strategy and
+// the MarkerDetector switches that change which markers it returns, the adaptive
+// window, tracking (trackMinMarkers, 0 when it is off) and OpenCL
+uint64_t detectionKey(const cv::Ptr< cv::aruco::DetectorParameters > &params,
+	const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, double downscale, bool refineStrategy,
+	bool adaptiveWindow, int trackMinMarkers, bool openCL);
+
+// Marker corners, ids and charuco corners of earlier runs, keyed by image hash.
+// The file is a header followed by records appended as frames are detected, each
+// a fixed header and flat little-endian arrays padded to 8 bytes, so it can be
+// mapped or read in one go; records made with other detection settings are
+// skipped on load. Lookups and additions may come from several threads.
+class DetectionCache {
+public:
+	struct Entry {
+		cv::Size imageSize;
+		std::vector< std::vector< cv::Point2f > > corners;
+		std::vector< int > ids;
+		cv::Mat charucoCorners, charucoIds;
+	};
+
+	DetectionCache() : file(0), paramsKey(0), nHits(0), nAdded(0) {}
+	~DetectionCache();
+
+	// loads the entries made with paramsKey and opens the file for appending
+	bool open(const std::string &filename, uint64_t paramsKey);
+	bool isOpen() const { return file != 0; }
+
+	bool contains(uint64_t imageKey) const;
+	bool find(uint64_t imageKey, Entry &entry);
+	// frames without markers are stored too, they need no detection again either
+	void add(uint64_t imageKey, cv::Size imageSize, const std::vector< std::vector< cv::Point2f > > &corners,
+		const std::vector< int > &ids, const cv::Mat &charucoCorners, const cv::Mat &charucoIds);
+
+	int size() const;
+	// every entry in file order
+	void entry(int index, Entry &entry) const;
+	int hits() const { return nHits; }
+	int added() const { return nAdded; }
+
+private:
+	void store(uint64_t imageKey, cv::Size imageSize, const cv::Point2f *corners, const int *ids, int markers,
+		const cv::Point2f *charucoCorners, const int *charucoIds, int charucoCount);
+	void read(int index, Entry &entry) const;
+
+	FILE *file;
+	uint64_t paramsKey;
+	// markers of entry i are view i of markers, its charuco corners start at charucoOffsets[i]
+	ViewStore markers;
+	std::vector< cv::Point2f > charucoCorners;
+	std::vector< int > charucoIds, charucoOffsets;
+	std::vector< cv::Size > imageSizes;
+	std::unordered_map< uint64_t, int > index;
+	int nHits, nAdded;
+	mutable std::mutex mtx;
+};
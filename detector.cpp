@@ -0,0 +1,392 @@
+#include "detector.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <ostream>
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	struct RefineScratch {
+		vector< uchar > found;
+		vector< Point2f > boardPoints, imagePoints, missing;
+		vector< vector< Point2f > > nearby;
+	};
+
+	// pixel centres of the shrunk image sit at (p + 0.5) * scale - 0.5 in the full one
+	void mapCorners(vector< vector< Point2f > > &corners, float scale, Point2f offset) {
+		Point2f shift = offset + Point2f(0.5f * (scale - 1), 0.5f * (scale - 1));
+		for(size_t i = 0; i < corners.size(); i++)
+			for(size_t j = 0; j < corners[i].size(); j++)
+				corners[i][j] = corners[i][j] * scale + shift;
+	}
+
+	Rect cornersBox(const vector< vector< Point2f > > &corners) {
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+		for(size_t i = 0; i < corners.size(); i++)
+			for(size_t j = 0; j < corners[i].size(); j++) {
+				minX = min(minX, corners[i][j].x);
+				minY = min(minY, corners[i][j].y);
+				maxX = max(maxX, corners[i][j].x);
+				maxY = max(maxY, corners[i][j].y);
+			}
+		if(minX > maxX)
+			return Rect();
+		return Rect(cvFloor(minX), cvFloor(minY), cvCeil(maxX - minX) + 1, cvCeil(maxY - minY) + 1);
+	}
+}
+
+bool readDetectorParameters(string filename, Ptr<aruco::DetectorParameters> &params) {
+	FileStorage fs(filename, FileStorage::READ);
+	if(!fs.isOpened())
+		return false;
+	fs["adaptiveThreshWinSizeMin"] >> params->adaptiveThreshWinSizeMin;
+	fs["adaptiveThreshWinSizeMax"] >> params->adaptiveThreshWinSizeMax;
+	fs["adaptiveThreshWinSizeStep"] >> params->adaptiveThreshWinSizeStep;
+	fs["adaptiveThreshConstant"] >> params->adaptiveThreshConstant;
+	fs["minMarkerPerimeterRate"] >> params->minMarkerPerimeterRate;
+	fs["maxMarkerPerimeterRate"] >> params->maxMarkerPerimeterRate;
+	fs["polygonalApproxAccuracyRate"] >> params->polygonalApproxAccuracyRate;
+	fs["minCornerDistanceRate"] >> params->minCornerDistanceRate;
+	fs["minDistanceToBorder"] >> params->minDistanceToBorder;
+	fs["minMarkerDistanceRate"] >> params->minMarkerDistanceRate;
+	fs["cornerRefinementMethod"] >> params->cornerRefinementMethod;
+	fs["cornerRefinementWinSize"] >> params->cornerRefinementWinSize;
+	fs["cornerRefinementMaxIterations"] >> params->cornerRefinementMaxIterations;
+	fs["cornerRefinementMinAccuracy"] >> params->cornerRefinementMinAccuracy;
+	fs["markerBorderBits"] >> params->markerBorderBits;
+	fs["perspectiveRemovePixelPerCell"] >> params->perspectiveRemovePixelPerCell;
+	fs["perspectiveRemoveIgnoredMarginPerCell"] >> params->perspectiveRemoveIgnoredMarginPerCell;
+	fs["maxErroneousBitsInBorderRate"] >> params->maxErroneousBitsInBorderRate;
+	fs["minOtsuStdDev"] >> params->minOtsuStdDev;
+	fs["errorCorrectionRate"] >> params->errorCorrectionRate;
+	return true;
+}
+
+MarkerDetector::MarkerDetector(const Ptr< aruco::Dictionary > &dictionary,
+	const Ptr< aruco::DetectorParameters > &params)
+	: dictionary(dictionary), params(params), searchParams(makePtr< aruco::DetectorParameters >(*params)),
+	tracking(false), minMarkers(4), padding(0.25f), haveTrack(false), downscale(1), openCL(false),
+	adaptiveWindow(false), window(0), minPerimeter(0), maxPerimeter(0), lastMarkers(0),
+	nFrames(0), nRoiFrames(0), nNarrowFrames(0), nWidenedFrames(0) {}
+
+MarkerDetector::MarkerDetector(const MarkerDetector &other)
+	: dictionary(other.dictionary), boardDictionary(other.boardDictionary), boardIds(other.boardIds),
+	params(other.params),
+	searchParams(makePtr< aruco::DetectorParameters >(*other.params)), tracking(other.tracking),
+	minMarkers(other.minMarkers), padding(other.padding), haveTrack(false), downscale(other.downscale),
+	openCL(other.openCL), adaptiveWindow(other.adaptiveWindow), window(0), minPerimeter(0), maxPerimeter(0),
+	lastMarkers(0), nFrames(0), nRoiFrames(0), nNarrowFrames(0), nWidenedFrames(0) {}
+
+void MarkerDetector::setTracking(bool enabled, int minMarkers, float padding) {
+	tracking = enabled;
+	this->minMarkers = max(minMarkers, 1);
+	this->padding = padding;
+	haveTrack = false;
+}
+
+void MarkerDetector::setDownscale(double factor) {
+	downscale = max(factor, 1.);
+}
+
+bool MarkerDetector::setOpenCL(bool enabled) {
+	openCL = enabled && ocl::haveOpenCL();
+	if(openCL)
+		ocl::setUseOpenCL(true);
+	return openCL == enabled;
+}
+
+void MarkerDetector::setAdaptiveWindow(bool enabled) {
+	adaptiveWindow = enabled;
+	window = 0;
+}
+
+void MarkerDetector::setBoardIds(const vector< int > &ids) {
+	boardIds.clear();
+	boardDictionary.release();
+	if(ids.empty())
+		return;
+	Mat bytes;
+	for(size_t i = 0; i < ids.size(); i++)
+		if(ids[i] >= 0 && ids[i] < dictionary->bytesList.rows &&
+			find(boardIds.begin(), boardIds.end(), ids[i]) == boardIds.end()) {
+			bytes.push_back(dictionary->bytesList.row(ids[i]));
+			boardIds.push_back(ids[i]);
+		}
+	// same correction radius, a candidate is accepted only within the distance the full dictionary allows
+	boardDictionary = makePtr< aruco::Dictionary >(bytes, dictionary->markerSize, dictionary->maxCorrectionBits);
+}
+
+void MarkerDetector::identify(const Mat &input, vector< vector< Point2f > > &corners, vector< int > &ids,
+	vector< vector< Point2f > > &rejected) {
+	if(boardDictionary.empty()) {
+		aruco::detectMarkers(input, dictionary, corners, ids, searchParams, rejected);
+		return;
+	}
+	aruco::detectMarkers(input, boardDictionary, corners, ids, searchParams, rejected);
+	for(size_t i = 0; i < ids.size(); i++)
+		ids[i] = boardIds[ids[i]];
+}
+
+void MarkerDetector::detect(const Mat &image, vector< vector< Point2f > > &corners, vector< int > &ids,
+	vector< vector< Point2f > > &rejected) {
+	Rect full(0, 0, image.cols, image.rows);
+	nFrames++;
+	// counted once the frame is done, so frames that fell back to the full sweep are not
+	bool narrow = window > 0;
+	if(tracking && haveTrack) {
+		Rect roi = predictRoi(image.size());
+		if(roi.area() > 0 && roi != full) {
+			search(image, roi, corners, ids, rejected);
+			if((int)ids.size() >= minMarkers) {
+				nRoiFrames++;
+				if(narrow)
+					nNarrowFrames++;
+				updateTrack(corners);
+				updateWindow(corners);
+				return;
+			}
+		}
+	}
+
+	search(image, full, corners, ids, rejected);
+	if(window > 0 && (int)ids.size() < max(lastMarkers / 2, 1)) {
+		// the narrowed sweep lost the board, retry this frame with the full one
+		window = 0;
+		narrow = false;
+		nWidenedFrames++;
+		search(image, full, corners, ids, rejected);
+	}
+	if(narrow)
+		nNarrowFrames++;
+	updateWindow(corners);
+	if(tracking) {
+		// updateTrack still sees whether the previous frame was tracked, so a board
+		// found for the first time or after a loss starts without velocity
+		if((int)ids.size() >= minMarkers)
+			updateTrack(corners);
+		else
+			haveTrack = false;
+	}
+}
+
+void MarkerDetector::search(const Mat &image, Rect area, vector< vector< Point2f > > &corners, vector< int > &ids,
+	vector< vector< Point2f > > &rejected) {
+	Mat view = image(area);
+	// perimeter limits are relative to the searched size, keep them equal in full-frame pixels
+	float rate = (float)max(image.cols, image.rows) / max(area.width, area.height);
+	searchParams->minMarkerPerimeterRate = params->minMarkerPerimeterRate * rate;
+	searchParams->maxMarkerPerimeterRate = params->maxMarkerPerimeterRate * rate;
+	searchParams->adaptiveThreshWinSizeMin = params->adaptiveThreshWinSizeMin;
+	searchParams->adaptiveThreshWinSizeMax = params->adaptiveThreshWinSizeMax;
+	if(window > 0) {
+		searchParams->adaptiveThreshWinSizeMin = searchParams->adaptiveThreshWinSizeMax = window;
+		// the observed perimeters, never outside the configured bounds
+		float areaSize = (float)max(area.width, area.height);
+		searchParams->minMarkerPerimeterRate = max(searchParams->minMarkerPerimeterRate, (double)(minPerimeter / areaSize));
+		searchParams->maxMarkerPerimeterRate = min(searchParams->maxMarkerPerimeterRate, (double)(maxPerimeter / areaSize));
+	}
+	Point2f offset((float)area.x, (float)area.y);
+
+	Mat input = view;
+	if(openCL) {
+		// grey and shrunk on the device, only the small grey image is read back
+		view.copyTo(deviceFrame);
+		if(deviceFrame.channels() == 3)
+			cvtColor(deviceFrame, deviceGrey, COLOR_BGR2GRAY);
+		else
+			swap(deviceFrame, deviceGrey);
+		if(downscale > 1) {
+			resize(deviceGrey, deviceSmall, Size(), 1 / downscale, 1 / downscale, INTER_AREA);
+			deviceSmall.copyTo(small);
+		}
+		else
+			deviceGrey.copyTo(small);
+		input = small;
+	}
+	else if(downscale > 1) {
+		resize(view, small, Size(), 1 / downscale, 1 / downscale, INTER_AREA);
+		input = small;
+	}
+
+	if(downscale <= 1) {
+		searchParams->cornerRefinementMethod = params->cornerRefinementMethod;
+		identify(input, corners, ids, rejected);
+		if(area.x != 0 || area.y != 0) {
+			mapCorners(corners, 1, offset);
+			mapCorners(rejected, 1, offset);
+		}
+		return;
+	}
+
+	// coarse candidates on the shrunk copy, corner refinement later at full resolution
+	searchParams->cornerRefinementMethod = aruco::CORNER_REFINE_NONE;
+	identify(input, corners, ids, rejected);
+	float scale = (float)view.cols / input.cols;
+	mapCorners(corners, scale, offset);
+	mapCorners(rejected, scale, offset);
+	// any configured method is carried out as cornerSubPix, aruco's contour and
+	// apriltag refinements are only reachable from within detectMarkers
+	if(params->cornerRefinementMethod != aruco::CORNER_REFINE_NONE)
+		refineCorners(image, corners);
+}
+
+void MarkerDetector::refineCorners(const Mat &image, vector< vector< Point2f > > &corners) {
+	int win = params->cornerRefinementWinSize;
+	Rect box = cornersBox(corners);
+	box.x -= win + 1;
+	box.y -= win + 1;
+	box.width += 2 * win + 2;
+	box.height += 2 * win + 2;
+	box &= Rect(0, 0, image.cols, image.rows);
+	if(box.area() == 0)
+		return;
+
+	// only the area around the markers is converted to grey
+	if(image.channels() == 3)
+		cvtColor(image(box), grey, COLOR_BGR2GRAY);
+	else
+		grey = image(box);
+	Point2f offset((float)box.x, (float)box.y);
+	TermCriteria criteria(TermCriteria::MAX_ITER | TermCriteria::EPS, params->cornerRefinementMaxIterations,
+		params->cornerRefinementMinAccuracy);
+	for(size_t i = 0; i < corners.size(); i++) {
+		for(size_t j = 0; j < corners[i].size(); j++)
+			corners[i][j] -= offset;
+		cornerSubPix(grey, corners[i], Size(win, win), Size(-1, -1), criteria);
+		for(size_t j = 0; j < corners[i].size(); j++)
+			corners[i][j] += offset;
+	}
+}
+
+Rect MarkerDetector::predictRoi(Size imageSize) const {
+	// constant velocity prediction, padded for motion and the squares around the markers
+	Rect2f box(lastBox.x + velocity.x, lastBox.y + velocity.y, lastBox.width, lastBox.height);
+	float padX = box.width * padding + fabs(velocity.x);
+	float padY = box.height * padding + fabs(velocity.y);
+	Rect roi(cvFloor(box.x - padX), cvFloor(box.y - padY),
+		cvCeil(box.width + 2 * padX), cvCeil(box.height + 2 * padY));
+	return roi & Rect(0, 0, imageSize.width, imageSize.height);
+}
+
+void MarkerDetector::updateWindow(const vector< vector< Point2f > > &corners) {
+	if(!adaptiveWindow || corners.empty()) {
+		window = 0;
+		lastMarkers = 0;
+		return;
+	}
+	float shortest = FLT_MAX, longest = 0, total = 0;
+	for(size_t i = 0; i < corners.size(); i++) {
+		float perimeter = (float)arcLength(corners[i], true);
+		shortest = min(shortest, perimeter);
+		longest = max(longest, perimeter);
+		total += perimeter;
+	}
+	// markers may shrink to half or grow to twice their size before the next frame misses them
+	minPerimeter = shortest / 2;
+	maxPerimeter = longest * 2;
+	lastMarkers = (int)corners.size();
+
+	// a window of about two bit cells of the image thresholding runs on
+	float side = total / corners.size() / 4 / (float)downscale;
+	float cell = side / (dictionary->markerSize + 2 * params->markerBorderBits);
+	float target = 2 * cell + 1;
+	int step = max(params->adaptiveThreshWinSizeStep, 1);
+	int best = params->adaptiveThreshWinSizeMin;
+	for(int w = params->adaptiveThreshWinSizeMin; w <= params->adaptiveThreshWinSizeMax; w += step)
+		if(fabs(w - target) < fabs(best - target))
+			best = w;
+	window = max(best, 3);
+}
+
+void MarkerDetector::updateTrack(const vector< vector< Point2f > > &corners) {
+	Rect2f box = cornersBox(corners);
+	velocity = haveTrack ? Point2f(box.x - lastBox.x, box.y - lastBox.y) : Point2f(0, 0);
+	lastBox = box;
+	haveTrack = true;
+}
+
+MarkerRefiner::MarkerRefiner(const Ptr< aruco::Board > &board) : board(board), nFrames(0), nRuns(0), nRecovered(0) {}
+
+bool MarkerRefiner::refine(const Mat &image, vector< vector< Point2f > > &corners, vector< int > &ids,
+	const vector< vector< Point2f > > &rejected) {
+	nFrames++;
+	int expected = (int)board->ids.size();
+	if((int)ids.size() >= expected || ids.empty() || rejected.empty())
+		return false;
+
+	ScopedTimer timer(Stats::REFINE);
+	// scratch of this thread, cleared but never freed between frames
+	thread_local RefineScratch scratch;
+	vector< uchar > &found = scratch.found;
+	vector< Point2f > &boardPoints = scratch.boardPoints, &imagePoints = scratch.imagePoints;
+	vector< Point2f > &missing = scratch.missing;
+	vector< vector< Point2f > > &nearby = scratch.nearby;
+	found.assign(expected, 0);
+	boardPoints.clear();
+	imagePoints.clear();
+	missing.clear();
+	nearby.clear();
+
+	// board plane -> image from the markers found, with their mean side in pixels
+	float side = 0;
+	for(size_t i = 0; i < ids.size(); i++) {
+		vector< int >::const_iterator it = find(board->ids.begin(), board->ids.end(), ids[i]);
+		if(it == board->ids.end())
+			continue;
+		int m = (int)(it - board->ids.begin());
+		found[m] = 1;
+		for(int k = 0; k < 4; k++) {
+			boardPoints.push_back(Point2f(board->objPoints[m][k].x, board->objPoints[m][k].y));
+			imagePoints.push_back(corners[i][k]);
+		}
+		side += (float)arcLength(corners[i], true) / 4;
+	}
+	if(boardPoints.empty())
+		return false;
+	side /= boardPoints.size() / 4;
+	Mat H = findHomography(boardPoints, imagePoints);
+	if(H.empty())
+		return false;
+
+	for(int m = 0; m < expected; m++)
+		if(!found[m]) {
+			Point2f center(0, 0);
+			for(int k = 0; k < 4; k++)
+				center += Point2f(board->objPoints[m][k].x, board->objPoints[m][k].y) * 0.25f;
+			missing.push_back(center);
+		}
+	perspectiveTransform(missing, missing, H);
+
+	// a candidate for a missing marker lies within about a marker side of its predicted center
+	float reach = 1.5f * side;
+	for(size_t r = 0; r < rejected.size(); r++) {
+		Point2f center(0, 0);
+		for(size_t k = 0; k < rejected[r].size(); k++)
+			center += rejected[r][k] * (1.f / rejected[r].size());
+		for(size_t m = 0; m < missing.size(); m++) {
+			Point2f d = center - missing[m];
+			if(d.dot(d) < reach * reach) {
+				nearby.push_back(rejected[r]);
+				break;
+			}
+		}
+	}
+	if(nearby.empty())
+		return false;
+	size_t before = ids.size();
+	aruco::refineDetectedMarkers(image, board, corners, ids, nearby);
+	nRuns++;
+	nRecovered += (int)(ids.size() - before);
+	return true;
+}
+
+void MarkerRefiner::report(ostream &out) const {
+	if(nFrames == 0)
+		return;
+	out << "  refind: ran on " << nRuns << " of " << nFrames << " frames, " << nRecovered << " markers recovered, "
+		<< stats().line(Stats::REFINE) << endl;
+}
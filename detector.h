@@ -0,0 +1,112 @@
+#pragma once
+#include <opencv2/aruco.hpp>
+#include <atomic>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// load marker detector parameters from a FileStorage file such as detectIn.yml
+bool readDetectorParameters(std::string filename, cv::Ptr< cv::aruco::DetectorParameters > &params);
+
+// Wraps aruco::detectMarkers with optional board tracking: once the board has
+// been found, later frames are searched only inside a padded box predicted from
+// the previous corners, falling back to the full frame when markers are lost.
+// Optionally the search runs on a downscaled copy and only the marker corners
+// are refined back at full resolution, with cornerSubPix whichever refinement
+// method the parameters name. With OpenCL the grey conversion and the
+// shrinking run on the device through UMats; aruco's thresholding and contour
+// search only take host Mats, so the grey image is read back for them.
+// With an adaptive window the threshold sweep collapses to the single window
+// size that suits the markers last seen, and the perimeter bounds to their
+// observed range; a frame where that loses the board is searched again with
+// the full sweep.
+// Restricted to the ids of a board, candidates are identified against a
+// dictionary holding only those markers: aruco still compares each candidate
+// with every entry in all four rotations, so the cost follows the board's marker
+// count rather than the predefined dictionary's size, and foreign markers never
+// become detections; the ids are mapped back to the full dictionary's.
+class MarkerDetector {
+public:
+	MarkerDetector(const cv::Ptr< cv::aruco::Dictionary > &dictionary,
+		const cv::Ptr< cv::aruco::DetectorParameters > &params);
+	// copies the configuration with its own scratch state, for use on another thread
+	MarkerDetector(const MarkerDetector &other);
+	MarkerDetector &operator=(const MarkerDetector &) = delete;
+
+	void setTracking(bool enabled, int minMarkers, float padding = 0.25f);
+	// factor > 1 detects on an image shrunk by that factor
+	void setDownscale(double factor);
+	// false when no OpenCL device is available
+	bool setOpenCL(bool enabled);
+	void setAdaptiveWindow(bool enabled);
+	// empty ids identify against the whole dictionary
+	void setBoardIds(const std::vector< int > &ids);
+
+	void detect(const cv::Mat &image, std::vector< std::vector< cv::Point2f > > &corners,
+		std::vector< int > &ids, std::vector< std::vector< cv::Point2f > > &rejected);
+
+	int frames() const { return nFrames; }
+	int roiFrames() const { return nRoiFrames; }
+	int narrowFrames() const { return nNarrowFrames; }
+	int widenedFrames() const { return nWidenedFrames; }
+
+private:
+	void search(const cv::Mat &image, cv::Rect area, std::vector< std::vector< cv::Point2f > > &corners,
+		std::vector< int > &ids, std::vector< std::vector< cv::Point2f > > &rejected);
+	void identify(const cv::Mat &input, std::vector< std::vector< cv::Point2f > > &corners,
+		std::vector< int > &ids, std::vector< std::vector< cv::Point2f > > &rejected);
+	void refineCorners(const cv::Mat &image, std::vector< std::vector< cv::Point2f > > &corners);
+	cv::Rect predictRoi(cv::Size imageSize) const;
+	void updateTrack(const std::vector< std::vector< cv::Point2f > > &corners);
+	void updateWindow(const std::vector< std::vector< cv::Point2f > > &corners);
+
+	cv::Ptr< cv::aruco::Dictionary > dictionary, boardDictionary;
+	// full dictionary id of every boardDictionary entry
+	std::vector< int > boardIds;
+	cv::Ptr< cv::aruco::DetectorParameters > params, searchParams;
+
+	bool tracking;
+	int minMarkers;
+	float padding;
+	bool haveTrack;
+	cv::Rect2f lastBox;
+	cv::Point2f velocity;
+
+	double downscale;
+	cv::Mat small, grey;
+	bool openCL;
+	cv::UMat deviceFrame, deviceGrey, deviceSmall;
+
+	bool adaptiveWindow;
+	// 0 sweeps the configured range, perimeters are in full-frame pixels
+	int window;
+	float minPerimeter, maxPerimeter;
+	int lastMarkers;
+
+	int nFrames, nRoiFrames, nNarrowFrames, nWidenedFrames;
+};
+
+// The refind strategy only where it can find something: a frame that already has
+// every board marker, or none to place the missing ones from, is passed over;
+// otherwise refineDetectedMarkers only sees the rejected candidates lying near
+// the position a board->image homography from the found markers predicts for a
+// missing one. Runs are timed in Stats::REFINE. One refiner may serve several
+// workers.
+class MarkerRefiner {
+public:
+	explicit MarkerRefiner(const cv::Ptr< cv::aruco::Board > &board);
+
+	// true when refineDetectedMarkers ran
+	bool refine(const cv::Mat &image, std::vector< std::vector< cv::Point2f > > &corners, std::vector< int > &ids,
+		const std::vector< std::vector< cv::Point2f > > &rejected);
+
+	int frames() const { return nFrames; }
+	int runs() const { return nRuns; }
+	int recovered() const { return nRecovered; }
+	// one line with the counts, nothing when no frame was seen
+	void report(std::ostream &out) const;
+
+private:
+	cv::Ptr< cv::aruco::Board > board;
+	std::atomic< int > nFrames, nRuns, nRecovered;
+};
@@ -0,0 +1,87 @@
+#include "frameRing.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+FrameRing::FrameRing(int depth, Size frameSize, int type, bool dropOldest)
+	: slots(max(depth, 1)), seqs(slots.size()), head(0), count(0), nPushed(0), nDropped(0),
+	dropOldest(dropOldest), closed(false) {
+	for(size_t i = 0; i < slots.size(); i++)
+		slots[i].create(frameSize, type);
+}
+
+void FrameRing::push(Mat &frame) {
+	{
+		unique_lock< mutex > lock(mtx);
+		int n = (int)slots.size();
+		if(!dropOldest)
+			space.wait(lock, [this, n] { return count < n || closed; });
+		if(closed)
+			return;
+		// drop the oldest frame when the consumer falls behind
+		if(count == n) {
+			head = (head + 1) % n;
+			count--;
+			nDropped++;
+		}
+		int tail = (head + count) % n;
+		swap(slots[tail], frame);
+		seqs[tail] = nPushed;
+		count++;
+		nPushed++;
+	}
+	ready.notify_one();
+}
+
+bool FrameRing::pop(Mat &frame, int *seq) {
+	{
+		unique_lock< mutex > lock(mtx);
+		ready.wait(lock, [this] { return count > 0 || closed; });
+		if(count == 0)
+			return false;
+		swap(slots[head], frame);
+		if(seq)
+			*seq = seqs[head];
+		head = (head + 1) % (int)slots.size();
+		count--;
+	}
+	space.notify_one();
+	return true;
+}
+
+void FrameRing::close() {
+	{
+		lock_guard< mutex > lock(mtx);
+		closed = true;
+	}
+	ready.notify_all();
+	space.notify_all();
+}
+
+int FrameRing::pushed() const {
+	lock_guard< mutex > lock(mtx);
+	return nPushed;
+}
+
+int FrameRing::dropped() const {
+	lock_guard< mutex > lock(mtx);
+	return nDropped;
+}
+
+void captureFrames(VideoCapture &cap, FrameRing &ring, const atomic< bool > &running) {
+	Mat frame;
+	for(;;) {
+		{
+			ScopedTimer timer(Stats::GRAB);
+			if(!running || !cap.grab())
+				break;
+		}
+		{
+			ScopedTimer timer(Stats::RETRIEVE);
+			cap.retrieve(frame);
+		}
+		ring.push(frame);
+	}
+	ring.close();
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Fixed-size ring of preallocated frames between the capture thread and the
+// detection loop. Frames are swapped in and out, never copied; when the ring is
+// full the oldest frame is overwritten and counted as dropped, or, for inputs
+// that must not lose frames, the producer waits for space.
+class FrameRing {
+public:
+	FrameRing(int depth, cv::Size frameSize, int type, bool dropOldest = true);
+
+	// hand a captured frame to the ring, frame receives a spare buffer in exchange
+	void push(cv::Mat &frame);
+	// wait for the oldest frame and swap it into frame, false once closed and empty;
+	// seq receives the frame's position in the capture order
+	bool pop(cv::Mat &frame, int *seq = 0);
+	void close();
+
+	int depth() const { return (int)slots.size(); }
+	int pushed() const;
+	int dropped() const;
+
+private:
+	std::vector< cv::Mat > slots;
+	std::vector< int > seqs;
+	int head, count;
+	int nPushed, nDropped;
+	bool dropOldest, closed;
+	mutable std::mutex mtx;
+	std::condition_variable ready, space;
+};
+
+// read frames from cap into ring until the input ends or running is cleared, then close the ring
+void captureFrames(cv::VideoCapture &cap, FrameRing &ring, const std::atomic< bool > &running);
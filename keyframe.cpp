@@ -0,0 +1,134 @@
+#include "keyframe.h"
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+using namespace cv;
+
+CoverageGrid::CoverageGrid(Size imageSize, int cols, int rows, int denseCorners)
+	: imageSize(imageSize), cols(cols), rows(rows), denseCorners(max(denseCorners, 1)), counts(cols * rows, 0),
+	covered(0), dense(0) {}
+
+int CoverageGrid::cellOf(const Point2f &p) const {
+	int cx = min(max((int)(p.x * cols / imageSize.width), 0), cols - 1);
+	int cy = min(max((int)(p.y * rows / imageSize.height), 0), rows - 1);
+	return cy * cols + cx;
+}
+
+int CoverageGrid::newCells(const Mat &charucoCorners) const {
+	vector< bool > hit(counts.size(), false);
+	int n = 0;
+	for(int i = 0; i < (int)charucoCorners.total(); i++) {
+		int c = cellOf(charucoCorners.ptr< Point2f >(0)[i]);
+		if(counts[c] == 0 && !hit[c]) {
+			hit[c] = true;
+			n++;
+		}
+	}
+	return n;
+}
+
+void CoverageGrid::add(const Mat &charucoCorners) {
+	for(int i = 0; i < (int)charucoCorners.total(); i++) {
+		int c = cellOf(charucoCorners.ptr< Point2f >(0)[i]);
+		int n = ++counts[c];
+		if(n == 1)
+			covered++;
+		if(n == denseCorners)
+			dense++;
+	}
+}
+
+double CoverageGrid::coverage() const {
+	return counts.empty() ? 0 : (double)covered / counts.size();
+}
+
+double CoverageGrid::denseCoverage() const {
+	return counts.empty() ? 0 : (double)dense / counts.size();
+}
+
+void CoverageGrid::draw(Mat &display) const {
+	if(imageSize.area() == 0 || display.empty())
+		return;
+	// outlines only, so the cost is the cell perimeters and not a pass over the preview
+	double sx = (double)display.cols / cols, sy = (double)display.rows / rows;
+	for(int cy = 0; cy < rows; cy++)
+		for(int cx = 0; cx < cols; cx++) {
+			int n = counts[cy * cols + cx];
+			if(n >= denseCorners)
+				continue;
+			Rect cell(Point(cvRound(cx * sx) + 1, cvRound(cy * sy) + 1),
+				Point(cvRound((cx + 1) * sx) - 2, cvRound((cy + 1) * sy) - 2));
+			rectangle(display, cell, n == 0 ? Scalar(0, 0, 255) : Scalar(0, 165, 255), 1);
+		}
+}
+
+KeyframeSelector::KeyframeSelector(const Ptr< aruco::CharucoBoard > &charBoard, int maxViews, int minCorners)
+	: charBoard(charBoard), maxViews(maxViews), minCorners(max(minCorners, 4)), minNewCells(2),
+	minPoseDistance(0.15f) {}
+
+bool KeyframeSelector::consider(const Mat &charucoCorners, const Mat &charucoIds, Size imageSize) {
+	if(full() || (int)charucoCorners.total() < minCorners)
+		return false;
+	if(poses.empty())
+		grid = CoverageGrid(imageSize);
+
+	PoseSignature pose;
+	if(!signature(charucoCorners, charucoIds, imageSize, pose))
+		return false;
+
+	bool accept = poses.empty() || grid.newCells(charucoCorners) >= minNewCells;
+	if(!accept) {
+		float nearest = FLT_MAX;
+		for(size_t i = 0; i < poses.size(); i++) {
+			const PoseSignature &p = poses[i];
+			float d = (float)norm(pose.center - p.center) + fabs(pose.spread - p.spread)
+				+ (float)norm(pose.tilt - p.tilt);
+			nearest = min(nearest, d);
+		}
+		accept = nearest >= minPoseDistance;
+	}
+	if(!accept)
+		return false;
+
+	grid.add(charucoCorners);
+	poses.push_back(pose);
+	return true;
+}
+
+bool KeyframeSelector::signature(const Mat &charucoCorners, const Mat &charucoIds, Size imageSize,
+	PoseSignature &pose) const {
+	int n = (int)charucoCorners.total();
+	const Point2f *img = charucoCorners.ptr< Point2f >(0);
+	const int *ids = charucoIds.ptr< int >(0);
+	float diag = (float)sqrt((double)imageSize.width * imageSize.width + (double)imageSize.height * imageSize.height);
+
+	vector< Point2f > boardPts(n), imgPts(img, img + n);
+	Point2f mean(0, 0);
+	for(int i = 0; i < n; i++) {
+		const Point3f &c = charBoard->chessboardCorners[ids[i]];
+		boardPts[i] = Point2f(c.x, c.y);
+		mean += img[i];
+	}
+	mean *= 1. / n;
+	double spread = 0;
+	for(int i = 0; i < n; i++) {
+		Point2f d = img[i] - mean;
+		spread += d.x * d.x + d.y * d.y;
+	}
+
+	Mat H = findHomography(boardPts, imgPts);
+	if(H.empty())
+		return false;
+	// projective terms scaled by the board extent are independent of units and distance
+	Size boardSquares = charBoard->getChessboardSize();
+	float extent = charBoard->getSquareLength() * max(boardSquares.width, boardSquares.height);
+	double h22 = H.at< double >(2, 2);
+	pose.center = Point2f(mean.x / imageSize.width, mean.y / imageSize.height);
+	pose.spread = (float)(sqrt(spread / n) / diag);
+	pose.tilt = Point2f((float)(H.at< double >(2, 0) / h22 * extent), (float)(H.at< double >(2, 1) / h22 * extent));
+	return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <vector>
+
+// Coarse grid over the image counting the charuco corners that fell in each cell.
+// A cell is dense once it holds denseCorners of them. Adding a view costs one
+// step per corner, the coverage figures are kept up to date as they go.
+class CoverageGrid {
+public:
+	CoverageGrid(cv::Size imageSize = cv::Size(), int cols = 8, int rows = 6, int denseCorners = 3);
+
+	// cells that these corners would cover for the first time
+	int newCells(const cv::Mat &charucoCorners) const;
+	void add(const cv::Mat &charucoCorners);
+	// fraction of cells holding at least one corner
+	double coverage() const;
+	// fraction of dense cells
+	double denseCoverage() const;
+	// outlines the cells that are not dense yet on display, a preview of the image at any
+	// scale: red when empty, orange when partly covered
+	void draw(cv::Mat &display) const;
+
+private:
+	int cellOf(const cv::Point2f &p) const;
+
+	cv::Size imageSize;
+	int cols, rows, denseCorners;
+	std::vector< int > counts;
+	int covered, dense;
+};
+
+// When live capture may stop on its own: at least minViews views were taken and
+// they densely cover this fraction of the image, denseCorners being what a grid
+// cell needs to count as dense. A coverage of 0 never stops.
+struct CoverageGoal {
+	CoverageGoal() : coverage(0), minViews(0), denseCorners(3) {}
+
+	bool met(const CoverageGrid &grid, int views) const {
+		return coverage > 0 && views >= minViews && grid.denseCoverage() >= coverage;
+	}
+
+	double coverage;
+	int minViews, denseCorners;
+};
+
+// Replaces pressing 'c': a view is accepted only when its charuco corners cover
+// new parts of the image or show the board in a pose unlike the views accepted
+// so far, and never more than maxViews of them.
+class KeyframeSelector {
+public:
+	KeyframeSelector(const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, int maxViews, int minCorners = 6);
+
+	bool consider(const cv::Mat &charucoCorners, const cv::Mat &charucoIds, cv::Size imageSize);
+
+	int accepted() const { return (int)poses.size(); }
+	bool full() const { return accepted() >= maxViews; }
+	const CoverageGrid &coverage() const { return grid; }
+
+private:
+	// board center and spread in the image plus the perspective tilt of the board plane
+	struct PoseSignature {
+		cv::Point2f center;
+		float spread;
+		cv::Point2f tilt;
+	};
+	bool signature(const cv::Mat &charucoCorners, const cv::Mat &charucoIds, cv::Size imageSize,
+		PoseSignature &pose) const;
+
+	cv::Ptr< cv::aruco::CharucoBoard > charBoard;
+	int maxViews, minCorners;
+	int minNewCells;
+	float minPoseDistance;
+	CoverageGrid grid;
+	std::vector< PoseSignature > poses;
+};
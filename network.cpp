@@ -0,0 +1,175 @@
+#include "network.h"
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <cerrno>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+	// a peer that went away fails the send instead of raising SIGPIPE
+#ifdef MSG_NOSIGNAL
+	const int sendFlags = MSG_NOSIGNAL;
+#else
+	const int sendFlags = 0;
+#endif
+}
+
+bool initNetwork() {
+#ifdef _WIN32
+	static once_flag started;
+	static bool ok = false;
+	call_once(started, [] {
+		WSADATA data;
+		ok = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	});
+	return ok;
+#else
+	return true;
+#endif
+}
+
+bool splitHostPort(const string &target, string &host, string &port) {
+	size_t colon = target.rfind(':');
+	if(colon == string::npos || colon + 1 == target.size())
+		return false;
+	host = colon == 0 ? string("127.0.0.1") : target.substr(0, colon);
+	port = target.substr(colon + 1);
+	return true;
+}
+
+Socket connectSocket(const string &target, bool udp) {
+	string host, port;
+	if(!splitHostPort(target, host, port)) {
+		cerr << target << " is not host:port" << endl;
+		return invalidSocket;
+	}
+	if(!initNetwork())
+		return invalidSocket;
+	addrinfo hints = addrinfo(), *found = 0;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = udp ? SOCK_DGRAM : SOCK_STREAM;
+	if(getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+		cerr << "Cannot resolve " << target << endl;
+		return invalidSocket;
+	}
+	Socket s = invalidSocket;
+	for(addrinfo *a = found; a && s == invalidSocket; a = a->ai_next) {
+		s = (Socket)socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if(s == invalidSocket)
+			continue;
+		if(connect(s, a->ai_addr, (int)a->ai_addrlen) != 0) {
+			closeSocket(s);
+			s = invalidSocket;
+		}
+	}
+	freeaddrinfo(found);
+	if(s == invalidSocket)
+		cerr << "Cannot connect to " << target << endl;
+	else if(!udp) {
+		// small messages go out at once instead of waiting to be coalesced
+		int noDelay = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&noDelay, sizeof(noDelay));
+	}
+	return s;
+}
+
+Socket listenSocket(const string &port) {
+	if(!initNetwork())
+		return invalidSocket;
+	addrinfo hints = addrinfo(), *found = 0;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if(getaddrinfo(0, port.c_str(), &hints, &found) != 0 || !found) {
+		cerr << "Cannot listen on port " << port << endl;
+		return invalidSocket;
+	}
+	Socket s = (Socket)socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+	if(s != invalidSocket) {
+		int reuse = 1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+		if(::bind(s, found->ai_addr, (int)found->ai_addrlen) != 0 || listen(s, 16) != 0) {
+			closeSocket(s);
+			s = invalidSocket;
+		}
+	}
+	freeaddrinfo(found);
+	if(s == invalidSocket)
+		cerr << "Cannot listen on port " << port << endl;
+	return s;
+}
+
+Socket acceptSocket(Socket listener) {
+	for(;;) {
+		Socket s = (Socket)accept(listener, 0, 0);
+		if(s != invalidSocket)
+			return s;
+#ifndef _WIN32
+		if(errno == EINTR)
+			continue;
+#endif
+		return invalidSocket;
+	}
+}
+
+void setReceiveTimeout(Socket s, int ms) {
+#ifdef _WIN32
+	DWORD timeout = ms;
+#else
+	timeval timeout;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+#endif
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+}
+
+bool receiveAll(Socket s, void *data, size_t size) {
+	char *p = (char *)data;
+	while(size > 0) {
+		int n = (int)recv(s, p, (int)size, 0);
+		if(n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool sendAll(Socket s, const void *data, size_t size) {
+	const char *p = (const char *)data;
+	while(size > 0) {
+		int n = (int)send(s, p, (int)size, sendFlags);
+		if(n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool sendDatagram(Socket s, const void *data, size_t size) {
+	return send(s, (const char *)data, (int)size, sendFlags) == (int)size;
+}
+
+void closeSocket(Socket s) {
+	if(s == invalidSocket)
+		return;
+#ifdef _WIN32
+	closesocket(s);
+#else
+	close((int)s);
+#endif
+}
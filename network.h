@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Thin portable layer over BSD sockets and winsock. Sockets are passed around as
+// intptr_t so callers need no platform headers; -1 is an invalid socket.
+typedef intptr_t Socket;
+const Socket invalidSocket = -1;
+
+// starts winsock once, a no-op elsewhere
+bool initNetwork();
+// "host:port", false without a port
+bool splitHostPort(const std::string &target, std::string &host, std::string &port);
+// a UDP socket connected to target (so send needs no address), or a TCP connection to it
+Socket connectSocket(const std::string &target, bool udp);
+// a TCP socket listening on every interface
+Socket listenSocket(const std::string &port);
+// waits for the next connection, invalidSocket once the listener fails
+Socket acceptSocket(Socket listener);
+// later receives fail after this long without data
+void setReceiveTimeout(Socket s, int ms);
+// blocks until every byte went out
+bool sendAll(Socket s, const void *data, size_t size);
+// blocks until size bytes arrived, false when the peer closed or the timeout passed
+bool receiveAll(Socket s, void *data, size_t size);
+// one datagram, false when it could not be sent whole
+bool sendDatagram(Socket s, const void *data, size_t size);
+void closeSocket(Socket s);
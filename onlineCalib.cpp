@@ -0,0 +1,102 @@
+#include "onlineCalib.h"
+#include <opencv2/calib3d.hpp>
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+OnlineCalibrator::OnlineCalibrator(const Ptr< aruco::CharucoBoard > &charBoard, int calibrationFlags,
+	double aspectRatio, int minViews)
+	: charBoard(charBoard), calibrationFlags(calibrationFlags), aspectRatio(aspectRatio), minViews(minViews),
+	repError(0), solvedViews(0), attemptedViews(0), stopping(false) {}
+
+OnlineCalibrator::~OnlineCalibrator() {
+	stop();
+}
+
+void OnlineCalibrator::start() {
+	stopping = false;
+	worker = thread(&OnlineCalibrator::run, this);
+}
+
+void OnlineCalibrator::stop() {
+	{
+		lock_guard< mutex > lock(mtx);
+		stopping = true;
+	}
+	added.notify_all();
+	if(worker.joinable())
+		worker.join();
+}
+
+void OnlineCalibrator::addView(const Mat &charucoCorners, const Mat &charucoIds, Size imageSize) {
+	// fewer corners can't constrain a view's pose
+	if(charucoCorners.total() < 4)
+		return;
+	{
+		lock_guard< mutex > lock(mtx);
+		allCharucoCorners.push_back(charucoCorners.clone());
+		allCharucoIds.push_back(charucoIds.clone());
+		this->imageSize = imageSize;
+	}
+	added.notify_one();
+}
+
+bool OnlineCalibrator::estimate(Mat &cameraMatrix, Mat &distCoeffs, double &repError, int &views) const {
+	lock_guard< mutex > lock(mtx);
+	if(this->cameraMatrix.empty())
+		return false;
+	this->cameraMatrix.copyTo(cameraMatrix);
+	this->distCoeffs.copyTo(distCoeffs);
+	repError = this->repError;
+	views = solvedViews;
+	return true;
+}
+
+void OnlineCalibrator::run() {
+	for(;;) {
+		// views are never modified once added, so the snapshot can share their data
+		vector< Mat > corners, ids;
+		Mat guessCamera, guessDist;
+		Size size;
+		{
+			unique_lock< mutex > lock(mtx);
+			added.wait(lock, [this] {
+				return stopping || ((int)allCharucoIds.size() >= minViews && (int)allCharucoIds.size() > attemptedViews);
+			});
+			if(stopping)
+				return;
+			corners = allCharucoCorners;
+			ids = allCharucoIds;
+			size = imageSize;
+			attemptedViews = (int)ids.size();
+			cameraMatrix.copyTo(guessCamera);
+			distCoeffs.copyTo(guessDist);
+		}
+
+		int flags = calibrationFlags;
+		if(!guessCamera.empty())
+			flags |= CALIB_USE_INTRINSIC_GUESS;
+		else if(flags & CALIB_FIX_ASPECT_RATIO) {
+			guessCamera = Mat::eye(3, 3, CV_64F);
+			guessCamera.at< double >(0, 0) = aspectRatio;
+		}
+
+		double err;
+		try {
+			err = aruco::calibrateCameraCharuco(corners, ids, charBoard, size, guessCamera, guessDist,
+				noArray(), noArray(), flags);
+		}
+		catch(const Exception &e) {
+			// a degenerate set of early views, wait for more
+			cerr << "Online calibration failed: " << e.what() << endl;
+			continue;
+		}
+
+		lock_guard< mutex > lock(mtx);
+		cameraMatrix = guessCamera;
+		distCoeffs = guessDist;
+		repError = err;
+		solvedViews = (int)ids.size();
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Re-solves the charuco calibration on a background thread whenever views have
+// been added, warm-started from the previous estimate, so the error can be
+// watched converging during capture and the final solve starts close to the end.
+class OnlineCalibrator {
+public:
+	OnlineCalibrator(const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, int calibrationFlags, double aspectRatio,
+		int minViews = 4);
+	~OnlineCalibrator();
+
+	void start();
+	void stop();
+	// the corners are copied
+	void addView(const cv::Mat &charucoCorners, const cv::Mat &charucoIds, cv::Size imageSize);
+	// latest solution, false until the first solve has finished
+	bool estimate(cv::Mat &cameraMatrix, cv::Mat &distCoeffs, double &repError, int &views) const;
+
+private:
+	void run();
+
+	cv::Ptr< cv::aruco::CharucoBoard > charBoard;
+	int calibrationFlags;
+	double aspectRatio;
+	int minViews;
+
+	mutable std::mutex mtx;
+	std::condition_variable added;
+	std::vector< cv::Mat > allCharucoCorners, allCharucoIds;
+	cv::Size imageSize;
+	cv::Mat cameraMatrix, distCoeffs;
+	double repError;
+	int solvedViews, attemptedViews;
+	bool stopping;
+	std::thread worker;
+};
@@ -0,0 +1,250 @@
+#include "pipeline.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include "allocCounter.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const int statsStages[DetectionPipeline::STAGE_COUNT] = {
+		Stats::DETECT, Stats::REFINE, Stats::INTERPOLATE, Stats::DRAW
+	};
+	// stages shown on the preview
+	const int overlayStages[] = { Stats::DETECT, Stats::REFINE, Stats::INTERPOLATE, Stats::DRAW, Stats::IMSHOW };
+
+	// back off while a queue is empty or full without giving up the lock-free path
+	void idle(int &spins) {
+		if(++spins < 64)
+			this_thread::yield();
+		else
+			this_thread::sleep_for(chrono::microseconds(200));
+	}
+}
+
+DetectionPipeline::DetectionPipeline(FrameRing &ring, MarkerDetector &detector,
+	const Ptr< aruco::CharucoBoard > &charBoard, bool refineStrategy, int jobCount)
+	: ring(ring), detector(detector), charBoard(charBoard),
+	board(charBoard.staticCast< aruco::Board >()), refineStrategy(refineStrategy), refiner(board),
+	previewScale(1), previewEvery(1), previewOpenCL(false), renderCount(0), freeJobs(jobCount), stopping(false), rendered(0), startTicks(0), stopTicks(0) {
+	for(int i = 0; i < jobCount; i++) {
+		jobs.push_back(unique_ptr< FrameJob >(new FrameJob()));
+		freeJobs.push(jobs.back().get());
+	}
+	for(int s = 0; s < STAGE_COUNT; s++) {
+		queues.push_back(unique_ptr< SpscQueue< FrameJob * > >(new SpscQueue< FrameJob * >(jobCount)));
+		finished[s] = false;
+		stageAllocations[s] = stageMatAllocations[s] = 0;
+	}
+}
+
+DetectionPipeline::~DetectionPipeline() {
+	if(!workers.empty())
+		stop();
+}
+
+void DetectionPipeline::setPreview(double scale, int every, bool openCL) {
+	previewScale = scale > 0 ? scale : 1;
+	previewEvery = max(every, 0);
+	previewOpenCL = openCL && ocl::haveOpenCL();
+}
+
+void DetectionPipeline::start() {
+	startTicks = getTickCount();
+	workers.push_back(thread(&DetectionPipeline::detectStage, this));
+	for(int s = REFINE; s < STAGE_COUNT; s++)
+		workers.push_back(thread(&DetectionPipeline::runStage, this, s));
+}
+
+FrameJob *DetectionPipeline::next() {
+	FrameJob *job;
+	int spins = 0;
+	while(!queues[RENDER]->pop(job)) {
+		if(finished[RENDER].load(memory_order_acquire))
+			return queues[RENDER]->pop(job) ? job : 0;
+		idle(spins);
+	}
+	rendered++;
+	return job;
+}
+
+void DetectionPipeline::release(FrameJob *job) {
+	freeJobs.push(job);
+}
+
+void DetectionPipeline::stop() {
+	stopping = true;
+	// keep draining so no stage blocks on a full queue while shutting down
+	FrameJob *job;
+	int spins = 0;
+	while(!finished[RENDER].load(memory_order_acquire)) {
+		if(queues[RENDER]->pop(job))
+			release(job);
+		else
+			idle(spins);
+	}
+	while(queues[RENDER]->pop(job))
+		release(job);
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+	stopTicks = getTickCount();
+}
+
+void DetectionPipeline::report(ostream &out) const {
+	double seconds = (stopTicks - startTicks) / getTickFrequency();
+	out << "Pipeline: " << rendered << " frames in " << seconds << " s ("
+		<< (seconds > 0 ? rendered / seconds : 0) << " fps)" << endl;
+	if(detector.roiFrames() > 0)
+		out << "  tracking: " << detector.roiFrames() << " of " << detector.frames()
+			<< " frames searched inside the predicted board region" << endl;
+	if(detector.narrowFrames() + detector.widenedFrames() > 0)
+		out << "  adaptive window: " << detector.narrowFrames() << " of " << detector.frames()
+			<< " frames thresholded once, " << detector.widenedFrames() << " widened again" << endl;
+	refiner.report(out);
+	if(rendered > 0) {
+		const char *names[STAGE_COUNT] = { "detect", "refine", "interpolate", "render" };
+		out << "  allocations per frame (operator new / Mat buffers):";
+		for(int s = 0; s < STAGE_COUNT; s++)
+			out << " " << names[s] << " " << (double)stageAllocations[s] / rendered << " / "
+				<< (double)stageMatAllocations[s] / rendered;
+		out << endl;
+	}
+}
+
+void DetectionPipeline::detectStage() {
+	int spins = 0;
+	for(;;) {
+		FrameJob *job;
+		if(!freeJobs.pop(job)) {
+			if(stopping)
+				break;
+			idle(spins);
+			continue;
+		}
+		spins = 0;
+		if(stopping || !ring.pop(job->image))
+			break;
+		processCounted(DETECT, *job);
+		while(!queues[DETECT]->push(job))
+			idle(spins);
+	}
+	finished[DETECT].store(true, memory_order_release);
+}
+
+void DetectionPipeline::runStage(int stage) {
+	SpscQueue< FrameJob * > &in = *queues[stage - 1];
+	SpscQueue< FrameJob * > &out = *queues[stage];
+	int spins = 0;
+	for(;;) {
+		FrameJob *job;
+		if(!in.pop(job)) {
+			// upstream publishes finished only after its last push
+			if(!finished[stage - 1].load(memory_order_acquire)) {
+				idle(spins);
+				continue;
+			}
+			if(!in.pop(job))
+				break;
+		}
+		spins = 0;
+		processCounted(stage, *job);
+		while(!out.push(job))
+			idle(spins);
+	}
+	finished[stage].store(true, memory_order_release);
+}
+
+void DetectionPipeline::processCounted(int stage, FrameJob &job) {
+	uint64_t before = threadAllocationCount(), matBefore = threadMatAllocationCount();
+	process(stage, job);
+	stageAllocations[stage] += threadAllocationCount() - before;
+	stageMatAllocations[stage] += threadMatAllocationCount() - matBefore;
+}
+
+void DetectionPipeline::process(int stage, FrameJob &job) {
+	if(stage == REFINE) {
+		// the refiner decides per frame and times only the frames it works on
+		if(refineStrategy)
+			refiner.refine(job.image, job.corners, job.ids, job.rejected);
+		return;
+	}
+	if(stage == RENDER) {
+		job.preview = previewEvery > 0 && renderCount++ % previewEvery == 0;
+		if(!job.preview)
+			return;
+	}
+	ScopedTimer timer(statsStages[stage]);
+	switch(stage) {
+	case DETECT:
+		detector.detect(job.image, job.corners, job.ids, job.rejected);
+		break;
+	case INTERPOLATE:
+		if(job.ids.empty()) {
+			job.charucoCorners.release();
+			job.charucoIds.release();
+		}
+		else
+			aruco::interpolateCornersCharuco(job.corners, job.ids, job.image, charBoard,
+				job.charucoCorners, job.charucoIds);
+		break;
+	case RENDER:
+		render(job);
+		break;
+	}
+}
+
+void DetectionPipeline::render(FrameJob &job) {
+	// a recycled job's display already has the preview size, so this reuses its buffer;
+	// grey frames are drawn on a colour copy
+	bool grey = job.image.channels() == 1;
+	if(previewScale == 1) {
+		if(grey)
+			cvtColor(job.image, job.display, COLOR_GRAY2BGR);
+		else
+			job.image.copyTo(job.display);
+		if(!job.ids.empty())
+			aruco::drawDetectedMarkers(job.display, job.corners);
+		if(job.charucoCorners.total() > 0)
+			aruco::drawDetectedCornersCharuco(job.display, job.charucoCorners, job.charucoIds);
+	}
+	else {
+		Size previewSize(cvRound(job.image.cols * previewScale), cvRound(job.image.rows * previewScale));
+		int interpolation = previewScale < 1 ? INTER_AREA : INTER_LINEAR;
+		Mat &scaled = grey ? job.previewGrey : job.display;
+		if(previewOpenCL) {
+			// only the preview sized image comes back for drawing
+			job.image.copyTo(job.deviceImage);
+			resize(job.deviceImage, job.deviceDisplay, previewSize, 0, 0, interpolation);
+			job.deviceDisplay.copyTo(scaled);
+		}
+		else
+			resize(job.image, scaled, previewSize, 0, 0, interpolation);
+		if(grey)
+			cvtColor(job.previewGrey, job.display, COLOR_GRAY2BGR);
+		job.previewCorners.resize(job.corners.size());
+		for(size_t i = 0; i < job.corners.size(); i++) {
+			job.previewCorners[i].resize(job.corners[i].size());
+			for(size_t j = 0; j < job.corners[i].size(); j++)
+				job.previewCorners[i][j] = job.corners[i][j] * (float)previewScale;
+		}
+		if(!job.ids.empty())
+			aruco::drawDetectedMarkers(job.display, job.previewCorners);
+		if(job.charucoCorners.total() > 0) {
+			job.charucoCorners.convertTo(job.previewCharuco, -1, previewScale);
+			aruco::drawDetectedCornersCharuco(job.display, job.previewCharuco, job.charucoIds);
+		}
+	}
+	drawStats(job.display);
+}
+
+void DetectionPipeline::drawStats(Mat &display) const {
+	int y = 20;
+	for(size_t i = 0; i < sizeof(overlayStages) / sizeof(overlayStages[0]); i++) {
+		if(stats().stage(overlayStages[i]).count() == 0)
+			continue;
+		putText(display, stats().line(overlayStages[i]), Point(10, y), FONT_HERSHEY_SIMPLEX, 0.5, Scalar(255, 0, 0), 2);
+		y += 20;
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "detector.h"
+#include "frameRing.h"
+#include "spscQueue.h"
+
+// Everything one frame carries through the pipeline. Jobs are pooled and
+// recycled, so their buffers are reused from frame to frame.
+struct FrameJob {
+	cv::Mat image, display;
+	std::vector< int > ids;
+	std::vector< std::vector< cv::Point2f > > corners, rejected;
+	cv::Mat charucoCorners, charucoIds;
+	// set when display holds a rendered preview of this frame
+	bool preview;
+	std::vector< std::vector< cv::Point2f > > previewCorners;
+	cv::Mat previewCharuco, previewGrey;
+	cv::UMat deviceImage, deviceDisplay;
+};
+
+// Detect -> refine -> interpolate -> render, each stage on its own worker and
+// connected by lock-free SPSC queues, so consecutive frames overlap. The main
+// thread takes rendered jobs with next() and hands them back with release().
+// Stage latencies are recorded in stats(). Jobs are a fixed pool whose buffers
+// and vectors are kept from frame to frame; report() gives the operator new
+// allocations and the Mat buffers each stage still makes per frame.
+class DetectionPipeline {
+public:
+	enum Stage { DETECT, REFINE, INTERPOLATE, RENDER, STAGE_COUNT };
+
+	DetectionPipeline(FrameRing &ring, MarkerDetector &detector,
+		const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, bool refineStrategy, int jobCount);
+	~DetectionPipeline();
+
+	// draw every Nth frame at the given scale, every = 0 renders nothing (headless);
+	// with openCL the preview is scaled on the device
+	void setPreview(double scale, int every, bool openCL = false);
+
+	void start();
+	// wait for the next rendered frame, null once the input is exhausted
+	FrameJob *next();
+	void release(FrameJob *job);
+	// finish in-flight frames and join the workers, the frame ring must be closed first
+	void stop();
+	void report(std::ostream &out) const;
+
+private:
+	void detectStage();
+	void runStage(int stage);
+	// process and count the stage's allocations
+	void processCounted(int stage, FrameJob &job);
+	void process(int stage, FrameJob &job);
+	void render(FrameJob &job);
+	void drawStats(cv::Mat &display) const;
+
+	FrameRing &ring;
+	MarkerDetector &detector;
+	cv::Ptr< cv::aruco::CharucoBoard > charBoard;
+	cv::Ptr< cv::aruco::Board > board;
+	bool refineStrategy;
+	MarkerRefiner refiner;
+	double previewScale;
+	int previewEvery;
+	bool previewOpenCL;
+	// only touched by the render worker
+	int renderCount;
+
+	std::vector< std::unique_ptr< FrameJob > > jobs;
+	// queues[s] carries jobs out of stage s, freeJobs returns them to the detect stage
+	std::vector< std::unique_ptr< SpscQueue< FrameJob * > > > queues;
+	SpscQueue< FrameJob * > freeJobs;
+	std::atomic< bool > finished[STAGE_COUNT];
+	std::atomic< bool > stopping;
+	std::vector< std::thread > workers;
+
+	int rendered;
+	int64 startTicks, stopTicks;
+	// written by each stage's own worker, read after they are joined
+	uint64_t stageAllocations[STAGE_COUNT], stageMatAllocations[STAGE_COUNT];
+};
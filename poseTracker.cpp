@@ -0,0 +1,142 @@
+#include "poseTracker.h"
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include "frameRing.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const char packetMagic[4] = { 'C', 'P', 'O', 'S' };
+	static_assert(sizeof(PosePacket) == 72, "pose datagrams have a fixed layout");
+}
+
+PoseTracker::PoseTracker(const Ptr< aruco::CharucoBoard > &charBoard, const Mat &cameraMatrix,
+	const Mat &distCoeffs)
+	: charBoard(charBoard), cameraMatrix(cameraMatrix), distCoeffs(distCoeffs), havePose(false) {}
+
+bool PoseTracker::estimate(const Mat &image, const vector< vector< Point2f > > &markerCorners,
+	const vector< int > &markerIds, Vec3d &rvec, Vec3d &tvec) {
+	corners.release();
+	ids.release();
+	if(!markerIds.empty())
+		aruco::interpolateCornersCharuco(markerCorners, markerIds, image, charBoard, corners, ids,
+			cameraMatrix, distCoeffs);
+	// fewer than four corners leave the pose ambiguous
+	if(ids.total() < 4) {
+		havePose = false;
+		return false;
+	}
+	rvec = lastR;
+	tvec = lastT;
+	havePose = aruco::estimatePoseCharucoBoard(corners, ids, charBoard, cameraMatrix, distCoeffs, rvec, tvec,
+		havePose);
+	if(havePose) {
+		lastR = rvec;
+		lastT = tvec;
+	}
+	return havePose;
+}
+
+void trackPoses(VideoCapture &cap, V4l2Capture *v4l2, MarkerDetector &detector,
+	const Ptr< aruco::CharucoBoard > &charBoard, const CameraParams &camera, const PoseOptions &options) {
+	Size frameSize = v4l2 ? v4l2->frameSize() :
+		Size((int)cap.get(CAP_PROP_FRAME_WIDTH), (int)cap.get(CAP_PROP_FRAME_HEIGHT));
+	if(camera.imageSize.area() > 0 && camera.imageSize != frameSize)
+		cerr << "Frames are " << frameSize.width << "x" << frameSize.height << " but the calibration was made at "
+			<< camera.imageSize.width << "x" << camera.imageSize.height << endl;
+
+	Socket stream = invalidSocket;
+	if(!options.streamTarget.empty()) {
+		stream = connectSocket(options.streamTarget, true);
+		if(stream == invalidSocket)
+			return;
+		cout << "Streaming poses to " << options.streamTarget << endl;
+	}
+
+	// a camera drops stale frames, the newest one is always the one to track
+	FrameRing ring(options.ringDepth, frameSize, v4l2 ? CV_8UC1 : CV_8UC3, !options.fromVideo);
+	atomic< bool > capturing(true);
+	thread captureThread = v4l2 ? thread(captureGreyFrames, ref(*v4l2), ref(ring), cref(capturing)) :
+		thread(captureFrames, ref(cap), ref(ring), cref(capturing));
+	if(options.previewEvery > 0)
+		cout << "Tracking the board pose, 'ESC' ends" << endl;
+
+	PoseTracker tracker(charBoard, camera.cameraMatrix, camera.distCoeffs);
+	vector< vector< Point2f > > corners, rejected;
+	vector< int > ids;
+	Vec3d rvec, tvec;
+	Mat frame, display;
+	int seq = 0, frames = 0, found = 0, sendFailures = 0;
+	int waitTime = options.fromVideo ? 0 : 1;
+	chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+	while(ring.pop(frame, &seq)) {
+		chrono::duration< double, milli > taken = chrono::steady_clock::now() - origin;
+		{
+			ScopedTimer timer(Stats::DETECT);
+			detector.detect(frame, corners, ids, rejected);
+		}
+		bool valid;
+		{
+			ScopedTimer timer(Stats::POSE);
+			valid = tracker.estimate(frame, corners, ids, rvec, tvec);
+		}
+		frames++;
+		found += valid;
+
+		if(stream != invalidSocket) {
+			PosePacket packet;
+			memset(&packet, 0, sizeof(packet));
+			memcpy(packet.magic, packetMagic, sizeof(packetMagic));
+			packet.seq = (uint32_t)seq;
+			packet.timestampMs = taken.count();
+			for(int i = 0; i < 3 && valid; i++) {
+				packet.rvec[i] = rvec[i];
+				packet.tvec[i] = tvec[i];
+			}
+			packet.corners = (int32_t)tracker.charucoIds().total();
+			packet.valid = valid;
+			sendFailures += !sendDatagram(stream, &packet, sizeof(packet));
+		}
+
+		if(options.previewEvery > 0 && frames % options.previewEvery == 0) {
+			{
+				ScopedTimer timer(Stats::DRAW);
+				if(frame.channels() == 1)
+					cvtColor(frame, display, COLOR_GRAY2BGR);
+				else
+					frame.copyTo(display);
+				if(tracker.charucoIds().total() > 0)
+					aruco::drawDetectedCornersCharuco(display, tracker.charucoCorners(), tracker.charucoIds());
+				if(valid)
+					aruco::drawAxis(display, camera.cameraMatrix, camera.distCoeffs, rvec, tvec,
+						2 * charBoard->getSquareLength());
+				if(options.previewScale != 1)
+					resize(display, display, Size(), options.previewScale, options.previewScale, INTER_AREA);
+			}
+			{
+				ScopedTimer timer(Stats::IMSHOW);
+				imshow("pose", display);
+			}
+			if((char)waitKey(waitTime) == 27)
+				break;
+		}
+	}
+	capturing = false;
+	ring.close();
+	captureThread.join();
+	closeSocket(stream);
+
+	double seconds = chrono::duration< double >(chrono::steady_clock::now() - origin).count();
+	cout << "Pose tracking: " << frames << " frames, board found in " << found << ", "
+		<< (seconds > 0 ? frames / seconds : 0) << " fps, dropped " << ring.dropped() << endl;
+	if(sendFailures > 0)
+		cerr << "Pose datagrams not sent: " << sendFailures << endl;
+	cout << stats().line(Stats::DETECT) << "\n" << stats().line(Stats::POSE) << endl;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <opencv2/aruco/charuco.hpp>
+#include <opencv2/videoio.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cameraParams.h"
+#include "detector.h"
+#include "network.h"
+#include "v4l2Capture.h"
+
+// Board pose from one frame's markers with a known camera model: the charuco
+// corners are interpolated with the model and the pose solved from them, warm
+// started from the previous frame's pose while the board stays in view.
+class PoseTracker {
+public:
+	PoseTracker(const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, const cv::Mat &cameraMatrix,
+		const cv::Mat &distCoeffs);
+
+	// false when too few corners were found, which also drops the warm start
+	bool estimate(const cv::Mat &image, const std::vector< std::vector< cv::Point2f > > &corners,
+		const std::vector< int > &ids, cv::Vec3d &rvec, cv::Vec3d &tvec);
+
+	const cv::Mat &charucoCorners() const { return corners; }
+	const cv::Mat &charucoIds() const { return ids; }
+
+private:
+	cv::Ptr< cv::aruco::CharucoBoard > charBoard;
+	cv::Mat cameraMatrix, distCoeffs;
+	cv::Mat corners, ids;
+	cv::Vec3d lastR, lastT;
+	bool havePose;
+};
+
+// One pose per UDP datagram, little-endian, in the board frame's meters and
+// Rodrigues rotation; valid is 0 when the board was not found in frame seq.
+// timestampMs counts from the start of tracking to when the frame was taken up.
+struct PosePacket {
+	char magic[4];
+	uint32_t seq;
+	double timestampMs;
+	double rvec[3], tvec[3];
+	int32_t corners, valid;
+};
+
+struct PoseOptions {
+	int ringDepth;
+	bool fromVideo;
+	double previewScale;
+	// 0 runs headless
+	int previewEvery;
+	// host:port for the pose datagrams, empty sends none
+	std::string streamTarget;
+};
+
+// Detects the board in every frame of cap (or v4l2 when given) and solves its pose,
+// streaming each over UDP and drawing its axes on the preview. ESC ends.
+void trackPoses(cv::VideoCapture &cap, V4l2Capture *v4l2, MarkerDetector &detector,
+	const cv::Ptr< cv::aruco::CharucoBoard > &charBoard, const CameraParams &camera, const PoseOptions &options);
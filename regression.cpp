@@ -0,0 +1,256 @@
+#include "regression.h"
+#include <opencv2/aruco/charuco.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include "calibration.h"
+#include "detector.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const Size frameSize(1280, 720);
+	const int pixelsPerSquare = 120;
+
+	// the camera every view is rendered through
+	struct TrueCamera {
+		TrueCamera()
+			: cameraMatrix((Mat_< double >(3, 3) << 910, 0, 652, 0, 910, 354, 0, 0, 1)),
+			distCoeffs((Mat_< double >(1, 5) << -0.21, 0.09, 0.0008, -0.0006, 0)) {}
+
+		// normalized ray of a pixel, the distortion inverted by fixed point iteration
+		Point2d ray(Point2d pixel) const {
+			const double *K = cameraMatrix.ptr< double >(0), *D = distCoeffs.ptr< double >(0);
+			Point2d d((pixel.x - K[2]) / K[0], (pixel.y - K[5]) / K[4]), p = d;
+			for(int i = 0; i < 30; i++) {
+				double r2 = p.x * p.x + p.y * p.y;
+				double radial = 1 + r2 * (D[0] + r2 * (D[1] + r2 * D[4]));
+				Point2d tangential(2 * D[2] * p.x * p.y + D[3] * (r2 + 2 * p.x * p.x),
+					D[2] * (r2 + 2 * p.y * p.y) + 2 * D[3] * p.x * p.y);
+				p = (d - tangential) * (1 / radial);
+			}
+			return p;
+		}
+
+		Mat cameraMatrix, distCoeffs;
+	};
+
+	// the case a run renders and what it does to the views
+	struct Case {
+		const char *name;
+		double noise, blur;
+		// jitter the corners of the first view, rejectOutlierViews has to drop it
+		bool corruptView;
+	};
+
+	// a clean render of the board and the homography from board coordinates (meters,
+	// z = 0) to its pixels, fitted on the detected corners so it holds whatever
+	// orientation draw() uses
+	bool renderBoard(const Ptr< aruco::CharucoBoard > &board, Mat &render, Mat &boardToRender) {
+		Size squares = board->getChessboardSize();
+		board->draw(Size(squares.width * pixelsPerSquare + 80, squares.height * pixelsPerSquare + 80), render, 40, 1);
+		MarkerDetector detector(board->dictionary, aruco::DetectorParameters::create());
+		vector< vector< Point2f > > corners, rejected;
+		vector< int > ids;
+		detector.detect(render, corners, ids, rejected);
+		Mat charucoCorners, charucoIds;
+		if(!ids.empty())
+			aruco::interpolateCornersCharuco(corners, ids, render, board, charucoCorners, charucoIds);
+		if(charucoIds.total() != board->chessboardCorners.size())
+			return false;
+		vector< Point2f > planar, pixels;
+		for(int i = 0; i < (int)charucoIds.total(); i++) {
+			const Point3f &c = board->chessboardCorners[charucoIds.at< int >(i)];
+			planar.push_back(Point2f(c.x, c.y));
+			pixels.push_back(charucoCorners.at< Point2f >(i));
+		}
+		boardToRender = findHomography(planar, pixels);
+		// a little blur keeps the minified remap from aliasing the square edges
+		GaussianBlur(render, render, Size(0, 0), 0.7);
+		return !boardToRender.empty();
+	}
+
+	// the ray of every frame pixel, the same for all views
+	Mat rayMap(const TrueCamera &camera) {
+		Mat rays(frameSize, CV_32FC2);
+		for(int y = 0; y < frameSize.height; y++)
+			for(int x = 0; x < frameSize.width; x++) {
+				Point2d r = camera.ray(Point2d(x, y));
+				rays.at< Vec2f >(y, x) = Vec2f((float)r.x, (float)r.y);
+			}
+		return rays;
+	}
+
+	Matx33d rotation(double rx, double ry, double rz) {
+		Matx33d x(1, 0, 0, 0, cos(rx), -sin(rx), 0, sin(rx), cos(rx));
+		Matx33d y(cos(ry), 0, sin(ry), 0, 1, 0, -sin(ry), 0, cos(ry));
+		Matx33d z(cos(rz), -sin(rz), 0, sin(rz), cos(rz), 0, 0, 0, 1);
+		return x * y * z;
+	}
+
+	// a tilted board somewhere in the frame, its front towards the camera: base turns
+	// the board over when the render's y axis runs against the board's
+	void randomPose(RNG &rng, const Ptr< aruco::CharucoBoard > &board, const TrueCamera &camera,
+		const Matx33d &base, Vec3d &rvec, Vec3d &tvec) {
+		const double degree = CV_PI / 180;
+		Matx33d R = rotation(rng.uniform(-35., 35.) * degree, rng.uniform(-35., 35.) * degree,
+			rng.uniform(-20., 20.) * degree) * base;
+		Size squares = board->getChessboardSize();
+		Vec3d centre(squares.width * board->getSquareLength() / 2, squares.height * board->getSquareLength() / 2, 0);
+		double z = rng.uniform(0.45, 0.8);
+		const double *K = camera.cameraMatrix.ptr< double >(0);
+		double u = frameSize.width * rng.uniform(0.25, 0.75), v = frameSize.height * rng.uniform(0.25, 0.75);
+		Vec3d position((u - K[2]) / K[0] * z, (v - K[5]) / K[4] * z, z);
+		tvec = position - R * centre;
+		Rodrigues(Mat(R), rvec);
+	}
+
+	// every pixel looks up the board point its ray hits, through the plane homography
+	void renderView(const Mat &render, const Mat &boardToRender, const Mat &rays, const Vec3d &rvec,
+		const Vec3d &tvec, Mat &view) {
+		Matx33d R;
+		Rodrigues(rvec, R);
+		Mat plane = (Mat_< double >(3, 3) << R(0, 0), R(0, 1), tvec[0], R(1, 0), R(1, 1), tvec[1],
+			R(2, 0), R(2, 1), tvec[2]);
+		Mat map;
+		perspectiveTransform(rays, map, boardToRender * plane.inv());
+		remap(render, view, map, noArray(), INTER_LINEAR, BORDER_CONSTANT, Scalar::all(255));
+	}
+
+	// where the true and the recovered camera image the same rays, over a grid inside the frame
+	double modelDistance(const TrueCamera &camera, const Mat &cameraMatrix, const Mat &distCoeffs) {
+		vector< Point3f > rays;
+		vector< Point2f > pixels, projected;
+		for(int gy = 0; gy <= 8; gy++)
+			for(int gx = 0; gx <= 15; gx++) {
+				Point2d pixel(frameSize.width * (0.08 + 0.84 * gx / 15), frameSize.height * (0.08 + 0.84 * gy / 8));
+				Point2d r = camera.ray(pixel);
+				rays.push_back(Point3f((float)r.x, (float)r.y, 1));
+				pixels.push_back(Point2f(pixel));
+			}
+		projectPoints(rays, Vec3d(0, 0, 0), Vec3d(0, 0, 0), cameraMatrix, distCoeffs, projected);
+		double worst = 0;
+		for(size_t i = 0; i < pixels.size(); i++)
+			worst = max(worst, (double)norm(projected[i] - pixels[i]));
+		return worst;
+	}
+
+	bool check(ostream &out, const string &name, double value, double limit) {
+		bool ok = value <= limit;
+		out << "  " << left << setw(26) << name << right << fixed << setprecision(4) << setw(12) << value
+			<< " <= " << setw(8) << limit << (ok ? "  ok" : "  FAILED") << endl;
+		return ok;
+	}
+
+	bool runCase(const Case &test, int viewCount, uint64_t seed, const RegressionLimits &limits,
+		const Ptr< aruco::CharucoBoard > &board, const Mat &render, const Mat &boardToRender,
+		const Matx33d &base, const Mat &rays, const TrueCamera &camera, ostream &out) {
+		out << test.name << endl;
+		RNG rng(seed);
+		MarkerDetector detector(board->dictionary, aruco::DetectorParameters::create());
+		CalibrationViews views;
+		views.reserve(viewCount, (int)board->ids.size());
+		LatencyHistogram detectTime;
+		vector< vector< Point2f > > corners, rejected;
+		vector< int > ids;
+		Mat view, charucoCorners, charucoIds;
+		int corrupted = -1;
+		for(int v = 0; v < viewCount; v++) {
+			Vec3d rvec, tvec;
+			randomPose(rng, board, camera, base, rvec, tvec);
+			renderView(render, boardToRender, rays, rvec, tvec, view);
+			if(test.noise > 0) {
+				Mat noise(view.size(), CV_32F), value;
+				rng.fill(noise, RNG::NORMAL, 0, test.noise);
+				view.convertTo(value, CV_32F);
+				value += noise;
+				value.convertTo(view, CV_8U);
+			}
+			if(test.blur > 0)
+				GaussianBlur(view, view, Size(0, 0), test.blur);
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			detector.detect(view, corners, ids, rejected);
+			charucoCorners.release();
+			charucoIds.release();
+			if(!ids.empty())
+				aruco::interpolateCornersCharuco(corners, ids, view, board, charucoCorners, charucoIds);
+			chrono::duration< double, milli > ms = chrono::steady_clock::now() - start;
+			detectTime.record(ms.count());
+			if(charucoIds.total() < 6)
+				continue;
+
+			if(test.corruptView && corrupted < 0) {
+				// per corner offsets no pose can absorb; without its image the solve keeps
+				// them instead of interpolating again
+				Mat offsets(charucoCorners.size(), CV_32FC2);
+				rng.fill(offsets, RNG::NORMAL, 0, 3);
+				charucoCorners += offsets;
+				corrupted = views.size();
+				views.add(corners, ids, charucoCorners, charucoIds, Mat(), Point(), view.size());
+			}
+			else
+				views.add(corners, ids, charucoCorners, charucoIds, view);
+		}
+
+		bool ok = check(out, "views without a board", viewCount - views.size(), viewCount / 5);
+		ok = check(out, "detect p95 (ms)", detectTime.percentile(0.95), limits.detectMs) && ok;
+
+		CalibrationResult calib;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		int flags = CALIB_FIX_ASPECT_RATIO;
+		if(!calibrateCharuco(views, board, flags, 1, calib)) {
+			out << "  calibration failed" << endl;
+			return false;
+		}
+		if(test.corruptView)
+			rejectOutlierViews(board, views.imgSize, flags, calib);
+		chrono::duration< double > seconds = chrono::steady_clock::now() - start;
+		ok = check(out, "calibration (s)", seconds.count(), limits.calibrateSeconds) && ok;
+
+		const Mat &K = calib.cameraMatrix, &trueK = camera.cameraMatrix;
+		ok = check(out, "fx error", fabs(K.at< double >(0, 0) / trueK.at< double >(0, 0) - 1), limits.focalError) && ok;
+		ok = check(out, "fy error", fabs(K.at< double >(1, 1) / trueK.at< double >(1, 1) - 1), limits.focalError) && ok;
+		ok = check(out, "principal point (px)", norm(Point2d(K.at< double >(0, 2) - trueK.at< double >(0, 2),
+			K.at< double >(1, 2) - trueK.at< double >(1, 2))), limits.principalError) && ok;
+		ok = check(out, "model distance (px)", modelDistance(camera, K, calib.distCoeffs), limits.modelError) && ok;
+		ok = check(out, "rep error (px)", calib.repError, limits.repError) && ok;
+		if(test.corruptView) {
+			bool dropped = corrupted >= 0 &&
+				find(calib.keptViews.begin(), calib.keptViews.end(), corrupted) == calib.keptViews.end();
+			ok = check(out, "corrupted view kept", dropped ? 0 : 1, 0) && ok;
+		}
+		return ok;
+	}
+}
+
+bool runCalibrationRegression(int views, uint64_t seed, const RegressionLimits &limits, ostream &out) {
+	Ptr< aruco::CharucoBoard > board = aruco::CharucoBoard::create(7, 5, 0.04f, 0.02f,
+		aruco::getPredefinedDictionary(aruco::DICT_6X6_250));
+	Mat render, boardToRender;
+	if(!renderBoard(board, render, boardToRender)) {
+		out << "The clean board render is not fully detected" << endl;
+		return false;
+	}
+	// a board seen from behind shows mirrored markers, which are never detected
+	Mat linear = boardToRender(Rect(0, 0, 2, 2));
+	Matx33d base = determinant(linear) < 0 ? Matx33d(1, 0, 0, 0, -1, 0, 0, 0, -1) : Matx33d::eye();
+
+	TrueCamera camera;
+	Mat rays = rayMap(camera);
+	const Case cases[] = {
+		{ "clean", 0, 0, false },
+		{ "noise+blur", 4, 1, false },
+		{ "corrupted view", 0, 0, true },
+	};
+	bool ok = true;
+	for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+		ok = runCase(cases[c], views, seed + c, limits, board, render, boardToRender, base, rays, camera, out) && ok;
+	out << (ok ? "Calibration regression passed" : "Calibration regression FAILED") << endl;
+	return ok;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+
+// Limits the calibration regression holds the pipeline to. Accuracy is against
+// the camera the views were rendered with, the timings are per run.
+struct RegressionLimits {
+	RegressionLimits()
+		: focalError(0.01), principalError(4), modelError(1.5), repError(0.5), detectMs(60),
+		calibrateSeconds(30) {}
+
+	// relative error of fx and fy, and pixels of the principal point
+	double focalError, principalError;
+	// largest distance in pixels, over the frame, between where the true and the
+	// recovered camera image the same ray; distortion terms trade off against each
+	// other, so they are compared through the pixels they produce
+	double modelError;
+	// charuco reprojection error in pixels
+	double repError;
+	// p95 of detection plus interpolation per view, and the whole calibrateCharuco solve
+	double detectMs, calibrateSeconds;
+};
+
+// Renders a charuco board through a known camera (intrinsics and radial and
+// tangential distortion) in views random poses, runs detection, interpolation and
+// calibrateCharuco headlessly and checks the recovered camera and the timings
+// against limits: once on clean views, once with noise and blur and once with a
+// corrupted view that rejectOutlierViews has to drop. Writes a line per check to
+// out and returns whether every check passed.
+bool runCalibrationRegression(int views, uint64_t seed, const RegressionLimits &limits, std::ostream &out);
@@ -0,0 +1,34 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+template< typename T >
+class SpscQueue {
+public:
+	explicit SpscQueue(size_t capacity) : buf(capacity + 1), head(0), tail(0) {}
+
+	bool push(const T &value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = (t + 1) % buf.size();
+		if(next == head.load(std::memory_order_acquire))
+			return false;
+		buf[t] = value;
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T &value) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load(std::memory_order_acquire))
+			return false;
+		value = buf[h];
+		head.store((h + 1) % buf.size(), std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector< T > buf;
+	std::atomic< size_t > head, tail;
+};
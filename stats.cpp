@@ -0,0 +1,110 @@
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+	const char *stageNames[Stats::STAGE_COUNT] = {
+		"grab", "retrieve", "detect", "refine", "interpolate", "draw", "imshow", "calibrate_aruco", "calibrate_charuco", "remap", "pose"
+	};
+
+	// lower bound of a bucket in microseconds
+	double bucketUs(int b) {
+		return pow(2., b / 8.);
+	}
+}
+
+LatencyHistogram::LatencyHistogram() {
+	reset();
+}
+
+void LatencyHistogram::reset() {
+	for(int b = 0; b < BUCKETS; b++)
+		buckets[b].store(0, memory_order_relaxed);
+	n.store(0, memory_order_relaxed);
+	totalNs.store(0, memory_order_relaxed);
+	maxNs.store(0, memory_order_relaxed);
+}
+
+void LatencyHistogram::record(double ms) {
+	double us = ms * 1000;
+	int b = us < 1 ? 0 : min((int)(log2(us) * 8), BUCKETS - 1);
+	buckets[b].fetch_add(1, memory_order_relaxed);
+	n.fetch_add(1, memory_order_relaxed);
+	int64_t ns = (int64_t)(us * 1000);
+	totalNs.fetch_add(ns, memory_order_relaxed);
+	int64_t prev = maxNs.load(memory_order_relaxed);
+	while(ns > prev && !maxNs.compare_exchange_weak(prev, ns, memory_order_relaxed)) {}
+}
+
+double LatencyHistogram::mean() const {
+	int64_t samples = count();
+	return samples > 0 ? totalNs.load(memory_order_relaxed) / 1e6 / samples : 0;
+}
+
+double LatencyHistogram::max() const {
+	return maxNs.load(memory_order_relaxed) / 1e6;
+}
+
+double LatencyHistogram::percentile(double q) const {
+	int64_t samples = count();
+	if(samples == 0)
+		return 0;
+	int64_t rank = (int64_t)ceil(q * samples), seen = 0;
+	for(int b = 0; b < BUCKETS; b++) {
+		seen += buckets[b].load(memory_order_relaxed);
+		if(seen >= rank)
+			// geometric middle of the bucket, never above the largest sample
+			return min(sqrt(bucketUs(b) * bucketUs(b + 1)) / 1000, max());
+	}
+	return max();
+}
+
+const char *Stats::name(int stage) {
+	return stageNames[stage];
+}
+
+string Stats::line(int stage) const {
+	const LatencyHistogram &h = stages[stage];
+	ostringstream out;
+	out.precision(3);
+	out << name(stage) << " " << h.percentile(0.5) << "/" << h.percentile(0.95) << "/" << h.percentile(0.99) << " ms";
+	return out.str();
+}
+
+string Stats::summary() const {
+	ostringstream out;
+	out << "Stage latency p50/p95/p99:" << endl;
+	for(int s = 0; s < STAGE_COUNT; s++)
+		if(stages[s].count() > 0)
+			out << "  " << line(s) << " (" << stages[s].count() << " samples, max " << stages[s].max() << " ms)" << endl;
+	return out.str();
+}
+
+bool Stats::writeJson(const string &filename) const {
+	ofstream out(filename.c_str());
+	if(!out)
+		return false;
+	out << "{\n  \"stages\": {";
+	bool first = true;
+	for(int s = 0; s < STAGE_COUNT; s++) {
+		const LatencyHistogram &h = stages[s];
+		if(h.count() == 0)
+			continue;
+		out << (first ? "\n" : ",\n") << "    \"" << name(s) << "\": { \"count\": " << h.count()
+			<< ", \"mean_ms\": " << h.mean() << ", \"p50_ms\": " << h.percentile(0.5)
+			<< ", \"p95_ms\": " << h.percentile(0.95) << ", \"p99_ms\": " << h.percentile(0.99)
+			<< ", \"max_ms\": " << h.max() << " }";
+		first = false;
+	}
+	out << "\n  }\n}\n";
+	return (bool)out;
+}
+
+Stats &stats() {
+	static Stats instance;
+	return instance;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Latency histogram with logarithmic buckets (8 per octave, 1 us to about two
+// minutes). Recording is a few relaxed atomic operations, so any thread may
+// record into it while another reads it.
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	void record(double ms);
+	void reset();
+
+	int64_t count() const { return n.load(std::memory_order_relaxed); }
+	double mean() const;
+	double max() const;
+	// latency below which the fraction q of the samples fall, to bucket resolution
+	double percentile(double q) const;
+
+	static const int BUCKETS = 8 * 27;
+
+private:
+	std::atomic< uint32_t > buckets[BUCKETS];
+	std::atomic< int64_t > n, totalNs, maxNs;
+};
+
+// Per-stage latencies of capture, detection and calibration.
+class Stats {
+public:
+	enum Stage {
+		GRAB, RETRIEVE, DETECT, REFINE, INTERPOLATE, DRAW, IMSHOW, CALIB_ARUCO, CALIB_CHARUCO, REMAP, POSE,
+		STAGE_COUNT
+	};
+
+	static const char *name(int stage);
+
+	void record(int stage, double ms) { stages[stage].record(ms); }
+	const LatencyHistogram &stage(int stage) const { return stages[stage]; }
+
+	// one line per stage with samples
+	std::string summary() const;
+	// "detect 12.1/15.3/18.0 ms" with p50/p95/p99
+	std::string line(int stage) const;
+	bool writeJson(const std::string &filename) const;
+
+private:
+	LatencyHistogram stages[STAGE_COUNT];
+};
+
+// process wide statistics
+Stats &stats();
+
+// records the time from construction to destruction into a stage
+class ScopedTimer {
+public:
+	explicit ScopedTimer(int stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+	~ScopedTimer() {
+		std::chrono::duration< double, std::milli > ms = std::chrono::steady_clock::now() - start;
+		stats().record(stage, ms.count());
+	}
+
+private:
+	int stage;
+	std::chrono::steady_clock::time_point start;
+};
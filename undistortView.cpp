@@ -0,0 +1,95 @@
+#include "undistortView.h"
+#include <opencv2/calib3d.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include "frameRing.h"
+#include "stats.h"
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	void drawGuides(InputOutputArray image) {
+		Size size = image.size();
+		for(int i = 1; i < 8; i++) {
+			int x = size.width * i / 8, y = size.height * i / 8;
+			line(image, Point(x, 0), Point(x, size.height - 1), Scalar(0, 255, 0), 1);
+			line(image, Point(0, y), Point(size.width - 1, y), Scalar(0, 255, 0), 1);
+		}
+	}
+}
+
+void showUndistorted(VideoCapture &cap, bool fromVideo, int ringDepth, const Mat &cameraMatrix,
+	const Mat &distCoeffs, double previewScale, bool useOpenCL) {
+	Size frameSize((int)cap.get(CAP_PROP_FRAME_WIDTH), (int)cap.get(CAP_PROP_FRAME_HEIGHT));
+	double scale = previewScale > 0 ? previewScale : 1;
+	Size previewSize(cvRound(frameSize.width * scale), cvRound(frameSize.height * scale));
+
+	// mapping straight to the preview size folds the resize into the remap
+	Mat previewCamera;
+	cameraMatrix.convertTo(previewCamera, CV_64F);
+	for(int c = 0; c < 3; c++) {
+		previewCamera.at< double >(0, c) *= scale;
+		previewCamera.at< double >(1, c) *= scale;
+	}
+	Mat map1, map2;
+	initUndistortRectifyMap(cameraMatrix, distCoeffs, Mat(), previewCamera, previewSize, CV_16SC2, map1, map2);
+
+	useOpenCL = useOpenCL && ocl::haveOpenCL();
+	ocl::setUseOpenCL(useOpenCL);
+	UMat deviceMap1, deviceMap2, deviceFrame, deviceView;
+	if(useOpenCL) {
+		map1.copyTo(deviceMap1);
+		map2.copyTo(deviceMap2);
+		cout << "Undistortion on OpenCL device " << ocl::Device::getDefault().name() << endl;
+	}
+
+	FrameRing ring(ringDepth, frameSize, CV_8UC3, !fromVideo);
+	atomic< bool > capturing(true);
+	thread captureThread(captureFrames, ref(cap), ref(ring), cref(capturing));
+	cout << "Undistorted view: 'u' toggles the raw frame, 'ESC' ends" << endl;
+
+	Mat frame, view;
+	bool undistort = true;
+	int waitTime = fromVideo ? 0 : 1;
+	int64 t0 = getTickCount();
+	int frames = 0;
+	while(ring.pop(frame)) {
+		{
+			ScopedTimer timer(Stats::REMAP);
+			if(!undistort)
+				resize(frame, view, previewSize, 0, 0, INTER_AREA);
+			else if(useOpenCL) {
+				frame.copyTo(deviceFrame);
+				remap(deviceFrame, deviceView, deviceMap1, deviceMap2, INTER_LINEAR);
+			}
+			else
+				remap(frame, view, map1, map2, INTER_LINEAR);
+		}
+		{
+			ScopedTimer timer(Stats::IMSHOW);
+			if(undistort && useOpenCL) {
+				drawGuides(deviceView);
+				imshow("undistorted", deviceView);
+			}
+			else {
+				drawGuides(view);
+				imshow("undistorted", view);
+			}
+		}
+		frames++;
+		char key = (char)waitKey(waitTime);
+		if(key == 27)
+			break;
+		if(key == 'u')
+			undistort = !undistort;
+	}
+	capturing = false;
+	ring.close();
+	captureThread.join();
+	double seconds = (getTickCount() - t0) / getTickFrequency();
+	cout << "Undistorted view: " << frames << " frames, " << (seconds > 0 ? frames / seconds : 0) << " fps" << endl;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+// Post-calibration check: shows the live input undistorted with straight guide
+// lines over it, so bent edges are easy to spot. Fixed-point (CV_16SC2) remap
+// tables are built once, directly at preview size, so every frame costs only
+// a remap; with useOpenCL the maps live on the device as UMats and remap runs
+// through OpenCL. 'u' toggles the raw view, ESC ends the check.
+void showUndistorted(cv::VideoCapture &cap, bool fromVideo, int ringDepth, const cv::Mat &cameraMatrix,
+	const cv::Mat &distCoeffs, double previewScale, bool useOpenCL);
@@ -0,0 +1,233 @@
+#include "v4l2Capture.h"
+#include <opencv2/imgcodecs.hpp>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include "stats.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+V4l2Capture::~V4l2Capture() {
+	close();
+}
+
+#ifdef __linux__
+
+namespace {
+	int xioctl(int fd, unsigned long request, void *arg) {
+		int r;
+		do
+			r = ioctl(fd, request, arg);
+		while(r == -1 && errno == EINTR);
+		return r;
+	}
+
+	const char *formatName(uint32_t format) {
+		switch(format) {
+		case V4L2_PIX_FMT_GREY: return "GREY";
+		case V4L2_PIX_FMT_NV12: return "NV12";
+		case V4L2_PIX_FMT_YUYV: return "YUYV";
+		default: return "MJPEG";
+		}
+	}
+}
+
+bool V4l2Capture::open(int index, Size requested, double fps) {
+	close();
+	ostringstream device;
+	device << "/dev/video" << index;
+	fd = ::open(device.str().c_str(), O_RDWR | O_NONBLOCK);
+	if(fd < 0) {
+		cerr << "Cannot open " << device.str() << endl;
+		return false;
+	}
+	v4l2_capability capability;
+	memset(&capability, 0, sizeof(capability));
+	if(xioctl(fd, VIDIOC_QUERYCAP, &capability) < 0 || !(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+		!(capability.capabilities & V4L2_CAP_STREAMING)) {
+		cerr << device.str() << " is not a streaming capture device" << endl;
+		close();
+		return false;
+	}
+
+	// formats with a plain luma plane first, MJPEG still has to be decoded
+	const uint32_t formats[] = { V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_MJPEG };
+	v4l2_format fmt;
+	format = 0;
+	for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]) && !format; i++) {
+		memset(&fmt, 0, sizeof(fmt));
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		fmt.fmt.pix.width = requested.width;
+		fmt.fmt.pix.height = requested.height;
+		fmt.fmt.pix.pixelformat = formats[i];
+		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+		// the driver substitutes a format it has, so only an unchanged one counts
+		if(xioctl(fd, VIDIOC_S_FMT, &fmt) == 0 && fmt.fmt.pix.pixelformat == formats[i])
+			format = formats[i];
+	}
+	if(!format) {
+		cerr << device.str() << " offers none of GREY, NV12, YUYV or MJPEG" << endl;
+		close();
+		return false;
+	}
+	size = Size(fmt.fmt.pix.width, fmt.fmt.pix.height);
+	bytesPerLine = fmt.fmt.pix.bytesperline;
+
+	if(fps > 0) {
+		v4l2_streamparm parm;
+		memset(&parm, 0, sizeof(parm));
+		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		parm.parm.capture.timeperframe.numerator = 1000;
+		parm.parm.capture.timeperframe.denominator = (uint32_t)(fps * 1000);
+		if(xioctl(fd, VIDIOC_S_PARM, &parm) < 0)
+			cerr << device.str() << ": frame rate " << fps << " not accepted" << endl;
+	}
+
+	v4l2_requestbuffers request;
+	memset(&request, 0, sizeof(request));
+	request.count = 4;
+	request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	request.memory = V4L2_MEMORY_MMAP;
+	if(xioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2) {
+		cerr << device.str() << ": cannot allocate capture buffers" << endl;
+		close();
+		return false;
+	}
+	for(uint32_t i = 0; i < request.count; i++) {
+		v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if(xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
+			close();
+			return false;
+		}
+		Buffer mapped;
+		mapped.length = buf.length;
+		mapped.start = mmap(0, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+		if(mapped.start == MAP_FAILED) {
+			cerr << device.str() << ": cannot map capture buffers" << endl;
+			close();
+			return false;
+		}
+		buffers.push_back(mapped);
+		if(xioctl(fd, VIDIOC_QBUF, &buf) < 0) {
+			close();
+			return false;
+		}
+	}
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if(xioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+		cerr << device.str() << ": cannot start streaming" << endl;
+		close();
+		return false;
+	}
+	cout << device.str() << ": " << size.width << "x" << size.height << " " << formatName(format) << endl;
+	return true;
+}
+
+void V4l2Capture::close() {
+	if(fd < 0)
+		return;
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	xioctl(fd, VIDIOC_STREAMOFF, &type);
+	for(size_t i = 0; i < buffers.size(); i++)
+		munmap(buffers[i].start, buffers[i].length);
+	buffers.clear();
+	::close(fd);
+	fd = -1;
+}
+
+bool V4l2Capture::read(Mat &grey, double *timestampMs) {
+	if(fd < 0)
+		return false;
+	for(;;) {
+		pollfd p;
+		p.fd = fd;
+		p.events = POLLIN;
+		p.revents = 0;
+		int ready = poll(&p, 1, 2000);
+		if(ready < 0 && errno == EINTR)
+			continue;
+		if(ready <= 0)
+			return false;
+
+		v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if(xioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
+			if(errno == EAGAIN)
+				continue;
+			return false;
+		}
+		const uchar *data = (const uchar *)buffers[buf.index].start;
+		bool ok = true;
+		grey.create(size, CV_8UC1);
+		if(format == V4L2_PIX_FMT_GREY || format == V4L2_PIX_FMT_NV12) {
+			// the Y plane comes first in NV12
+			for(int y = 0; y < size.height; y++)
+				memcpy(grey.ptr(y), data + y * bytesPerLine, size.width);
+		}
+		else if(format == V4L2_PIX_FMT_YUYV) {
+			for(int y = 0; y < size.height; y++) {
+				const uchar *row = data + y * bytesPerLine;
+				uchar *out = grey.ptr(y);
+				for(int x = 0; x < size.width; x++)
+					out[x] = row[2 * x];
+			}
+		}
+		else {
+			// a corrupt frame is skipped, the next one is usually fine
+			Mat encoded(1, (int)buf.bytesused, CV_8U, (void *)data);
+			imdecode(encoded, IMREAD_GRAYSCALE, &grey);
+			ok = !grey.empty() && grey.size() == size;
+		}
+		if(timestampMs)
+			*timestampMs = buf.timestamp.tv_sec * 1000. + buf.timestamp.tv_usec / 1000.;
+		if(xioctl(fd, VIDIOC_QBUF, &buf) < 0)
+			return false;
+		if(ok)
+			return true;
+	}
+}
+
+#else
+
+bool V4l2Capture::open(int index, Size requested, double fps) {
+	cerr << "V4L2 capture is only available on Linux" << endl;
+	return false;
+}
+
+void V4l2Capture::close() {}
+
+bool V4l2Capture::read(Mat &grey, double *timestampMs) {
+	return false;
+}
+
+#endif
+
+void captureGreyFrames(V4l2Capture &cap, FrameRing &ring, const atomic< bool > &running) {
+	Mat frame;
+	for(;;) {
+		{
+			ScopedTimer timer(Stats::GRAB);
+			if(!running || !cap.read(frame))
+				break;
+		}
+		ring.push(frame);
+	}
+	ring.close();
+}
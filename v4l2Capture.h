@@ -0,0 +1,42 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "frameRing.h"
+
+// Camera capture straight from a V4L2 device (Linux only, open fails elsewhere).
+// The driver's buffers are memory mapped and only their luma plane is taken:
+// GREY and NV12 rows are copied as they are, YUYV is de-interleaved and MJPEG is
+// decoded to grey alone. Frames reach detection as CV_8UC1, written into the
+// ring's own buffers, with no colour conversion or per-frame allocation.
+class V4l2Capture {
+public:
+	V4l2Capture() : fd(-1), format(0), bytesPerLine(0) {}
+	~V4l2Capture();
+
+	// /dev/video<index>; size and fps are requests, the driver picks its nearest mode (fps 0 keeps its rate)
+	bool open(int index, cv::Size size, double fps);
+	void close();
+	bool isOpened() const { return fd >= 0; }
+	cv::Size frameSize() const { return size; }
+
+	// wait for the next frame and write its luma plane to grey, reusing grey's buffer;
+	// timestampMs receives the driver's capture time
+	bool read(cv::Mat &grey, double *timestampMs = 0);
+
+private:
+	struct Buffer {
+		void *start;
+		size_t length;
+	};
+
+	int fd;
+	uint32_t format;
+	cv::Size size;
+	size_t bytesPerLine;
+	std::vector< Buffer > buffers;
+};
+
+// read grey frames from cap into ring until the device fails or running is cleared, then close the ring
+void captureGreyFrames(V4l2Capture &cap, FrameRing &ring, const std::atomic< bool > &running);
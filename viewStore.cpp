@@ -0,0 +1,35 @@
+#include "viewStore.h"
+
+using namespace std;
+using namespace cv;
+
+void ViewStore::reserve(int views, int markersPerView) {
+	corners.reserve((size_t)views * markersPerView * 4);
+	ids.reserve((size_t)views * markersPerView);
+	offsets.reserve(views + 1);
+	counts.reserve(views);
+}
+
+void ViewStore::add(const vector< vector< Point2f > > &markerCorners, const vector< int > &markerIds) {
+	CV_Assert(markerCorners.size() == markerIds.size());
+	for(size_t m = 0; m < markerCorners.size(); m++) {
+		CV_Assert(markerCorners[m].size() == 4);
+		corners.insert(corners.end(), markerCorners[m].begin(), markerCorners[m].end());
+	}
+	ids.insert(ids.end(), markerIds.begin(), markerIds.end());
+	counts.push_back((int)markerIds.size());
+	offsets.push_back((int)ids.size());
+}
+
+void ViewStore::add(const Point2f *cornersIn, const int *idsIn, int count) {
+	corners.insert(corners.end(), cornersIn, cornersIn + 4 * count);
+	ids.insert(ids.end(), idsIn, idsIn + count);
+	counts.push_back(count);
+	offsets.push_back((int)ids.size());
+}
+
+void ViewStore::headers(int begin, int end, vector< Mat > &out) const {
+	out.resize(end - begin);
+	for(int m = begin; m < end; m++)
+		out[m - begin] = Mat(1, 4, CV_32FC2, (void *)&corners[4 * m]);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <vector>
+
+// Marker detections of all calibration views in flat arrays: the four corners
+// of marker m at corners[4 * m], its id at ids[m], and the markers of view v at
+// [offsets[v], offsets[v + 1]). counts holds the per-view marker numbers in the
+// form calibrateCameraAruco takes them. Views are appended in place, so adding
+// one costs no allocation once the arrays are reserved.
+class ViewStore {
+public:
+	ViewStore() : offsets(1, 0) {}
+
+	void reserve(int views, int markersPerView);
+	void add(const std::vector< std::vector< cv::Point2f > > &markerCorners, const std::vector< int > &markerIds);
+	// count markers with four corners each at cornersIn
+	void add(const cv::Point2f *cornersIn, const int *idsIn, int count);
+
+	int size() const { return (int)counts.size(); }
+	int markers(int view) const { return counts[view]; }
+	int totalMarkers() const { return (int)ids.size(); }
+	const int *viewIds(int view) const { return ids.data() + offsets[view]; }
+	const cv::Point2f *viewCorners(int view) const { return corners.data() + 4 * offsets[view]; }
+
+	// 1x4 CV_32FC2 headers over the stored corners of markers [begin, end), no corner is copied
+	void headers(int begin, int end, std::vector< cv::Mat > &out) const;
+
+	std::vector< cv::Point2f > corners;
+	std::vector< int > ids;
+	std::vector< int > offsets, counts;
+};